@@ -23,3 +23,9 @@ int posix_spawnp(pid_t *pid, const char *file,
     return __spawni(pid, file, file_actions, attrp, argv, envp, SPAWN_XFLAGS_USE_PATH);
 }
 
+
+int posix_spawn_pipeline_np(struct posix_spawn_stage *stages, int nstages,
+                const posix_spawnattr_t *attrp, char *const envp[])
+{
+    return __spawni_pipeline(stages, nstages, attrp, envp);
+}
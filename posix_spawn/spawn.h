@@ -35,7 +35,11 @@ typedef struct
   struct sched_param __sp;
   int __policy;
   int __tcpgrp;
-  int __pad[15];
+  int __pipesize;
+  int __nice;
+  const cpu_set_t *__affinity;
+  size_t __affinitysize;
+  int __pad[8];
 } posix_spawnattr_t;
 
 
@@ -61,6 +65,8 @@ typedef struct
 # define POSIX_SPAWN_USEVFORK		0x40
 # define POSIX_SPAWN_SETSID		0x80
 # define POSIX_SPAWN_TCSETPGROUP	0x100
+# define POSIX_SPAWN_SETNICE_NP		0x200
+# define POSIX_SPAWN_SETAFFINITY_NP	0x400
 #endif
 
 
@@ -90,6 +96,51 @@ extern int posix_spawnp (pid_t *__pid, const char *__file,
 			 char *const __argv[], char *const __envp[])
     __nonnull ((2, 5));
 
+#ifdef __USE_GNU
+/* One stage of a pipeline launched by `posix_spawn_pipeline_np'.  */
+struct posix_spawn_stage
+{
+  /* Filled in by the caller.  */
+  const char *file;		/* searched for in PATH as by `posix_spawnp' */
+  const char *path;		/* if not NULL, tried first as is */
+  char *const *argv;
+  const posix_spawn_file_actions_t *file_actions;  /* may be NULL */
+
+  /* Filled in by `posix_spawn_pipeline_np'.  */
+  pid_t pid;
+  int pidfd;			/* close-on-exec, to be closed by the caller */
+  int err;			/* 0 if the stage was spawned */
+  int path_err;			/* if not 0, exec'ing PATH failed with this
+				   error and FILE was searched for instead */
+};
+
+/* Spawn all NSTAGES stages of a pipeline, each with the attributes in
+   *ATTRP, connecting each stage's standard output to the next stage's
+   standard input before running its file actions.  If ATTRP asks for a
+   new process group (pgroup 0), all stages join the group of the first
+   stage spawned, and only that stage takes the terminal.  Stages that
+   fail do not stop the others from being spawned.  Returns 0, or the
+   error of the first stage that failed.  */
+extern int posix_spawn_pipeline_np (struct posix_spawn_stage *__stages,
+				    int __nstages,
+				    const posix_spawnattr_t *__attrp,
+				    char *const __envp[])
+    __nonnull ((1, 4));
+
+/* Declare *SET as the complete set of signals the program has installed
+   handlers for.  Spawned children then reset only these signals (and those
+   in the POSIX_SPAWN_SETSIGDEF set) instead of querying every signal.
+   The program must call this again whenever it installs or removes a
+   handler.  */
+extern int posix_spawn_sethandlers_np (const sigset_t *__set)
+     __THROW __nonnull ((1));
+
+/* Store the number of spawns that reused a cached child stack in *HITS
+   and the number that had to map a fresh one in *MISSES.  */
+extern void posix_spawn_stack_stats_np (unsigned long *__hits,
+					unsigned long *__misses)
+     __THROW __nonnull ((1, 2));
+#endif
 
 /* Initialize data structure with attributes for `spawn' to default values.  */
 extern int posix_spawnattr_init (posix_spawnattr_t *__attr)
@@ -179,6 +230,43 @@ extern int posix_spawnattr_tcsetpgrp_np (posix_spawnattr_t *__attr, int fd)
 extern int posix_spawnattr_tcgetpgrp_np (const posix_spawnattr_t *
 					 __restrict __attr, int *fd)
      __THROW __nonnull ((1, 2));
+
+/* Make the pipes `posix_spawn_pipeline_np' creates between stages hold
+   SIZE bytes (see F_SETPIPE_SZ).  A SIZE of 0 keeps the system default.
+   If the kernel refuses the size, the pipe keeps its default size.  */
+extern int posix_spawnattr_setpipesize_np (posix_spawnattr_t *__attr,
+					   int __size)
+     __THROW __nonnull ((1));
+
+/* Store the pipe size set in the attribute structure in *SIZE.  */
+extern int posix_spawnattr_getpipesize_np (const posix_spawnattr_t *
+					   __restrict __attr, int *__size)
+     __THROW __nonnull ((1, 2));
+
+/* Give the spawned process the nice value NICE (see setpriority) if
+   POSIX_SPAWN_SETNICE_NP is set.  */
+extern int posix_spawnattr_setnice_np (posix_spawnattr_t *__attr, int __nice)
+     __THROW __nonnull ((1));
+
+/* Store the nice value set in the attribute structure in *NICE.  */
+extern int posix_spawnattr_getnice_np (const posix_spawnattr_t *
+				       __restrict __attr, int *__nice)
+     __THROW __nonnull ((1, 2));
+
+/* Restrict the spawned process to the CPUs in *CPUSET, which is SIZE
+   bytes long (see sched_setaffinity), if POSIX_SPAWN_SETAFFINITY_NP is
+   set.  The set is not copied and must stay valid until the spawn.  */
+extern int posix_spawnattr_setaffinity_np (posix_spawnattr_t *__attr,
+					   size_t __size,
+					   const cpu_set_t *__cpuset)
+     __THROW __nonnull ((1, 3));
+
+/* Store the CPU set in the attribute structure in *CPUSET and its size
+   in *SIZE.  */
+extern int posix_spawnattr_getaffinity_np (const posix_spawnattr_t *
+					   __restrict __attr, size_t *__size,
+					   const cpu_set_t **__cpuset)
+     __THROW __nonnull ((1, 2, 3));
 #endif
 
 /* Initialize data structure for file attribute for `spawn' call.  */
@@ -74,6 +74,10 @@ extern int __spawni (pid_t *pid, const char *path,
 		     const posix_spawnattr_t *attrp, char *const argv[],
 		     char *const envp[], int xflags);
 
+extern int __spawni_pipeline (struct posix_spawn_stage *stages, int nstages,
+			      const posix_spawnattr_t *attrp,
+			      char *const envp[]);
+
 /* Return true if FD falls into the range valid for file descriptors.
    The check in this form is mandated by POSIX.  */
 bool __spawn_valid_fd (int fd);
@@ -0,0 +1,103 @@
+/* Scheduling, nice and CPU affinity attributes for spawned processes.
+   Copyright (C) 2000-2021 Free Software Foundation, Inc.
+   This file is part of the GNU C Library.
+
+   The GNU C Library is free software; you can redistribute it and/or
+   modify it under the terms of the GNU Lesser General Public
+   License as published by the Free Software Foundation; either
+   version 2.1 of the License, or (at your option) any later version.
+
+   The GNU C Library is distributed in the hope that it will be useful,
+   but WITHOUT ANY WARRANTY; without even the implied warranty of
+   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+   Lesser General Public License for more details.
+
+   You should have received a copy of the GNU Lesser General Public
+   License along with the GNU C Library; if not, see
+   <https://www.gnu.org/licenses/>.  */
+
+#define _GNU_SOURCE 1
+#include <errno.h>
+#include <sched.h>
+#include <spawn.h>
+#include <string.h>
+
+/* Store scheduling policy in the attribute structure.  Unlike the
+   generic version, this accepts the Linux-specific SCHED_BATCH and
+   SCHED_IDLE policies as well.  */
+int
+posix_spawnattr_setschedpolicy (posix_spawnattr_t *attr, int policy)
+{
+  switch (policy)
+    {
+    case SCHED_OTHER:
+    case SCHED_FIFO:
+    case SCHED_RR:
+    case SCHED_BATCH:
+    case SCHED_IDLE:
+      break;
+    default:
+      return EINVAL;
+    }
+
+  attr->__policy = policy;
+  return 0;
+}
+
+/* Get scheduling policy from the attribute structure.  */
+int
+posix_spawnattr_getschedpolicy (const posix_spawnattr_t *attr, int *policy)
+{
+  *policy = attr->__policy;
+  return 0;
+}
+
+/* Store scheduling parameters in the attribute structure.  */
+int
+posix_spawnattr_setschedparam (posix_spawnattr_t *attr,
+			       const struct sched_param *param)
+{
+  memcpy (&attr->__sp, param, sizeof (struct sched_param));
+  return 0;
+}
+
+/* Get scheduling parameters from the attribute structure.  */
+int
+posix_spawnattr_getschedparam (const posix_spawnattr_t *attr,
+			       struct sched_param *param)
+{
+  memcpy (param, &attr->__sp, sizeof (struct sched_param));
+  return 0;
+}
+
+int
+posix_spawnattr_setnice_np (posix_spawnattr_t *attr, int nice)
+{
+  attr->__nice = nice;
+  return 0;
+}
+
+int
+posix_spawnattr_getnice_np (const posix_spawnattr_t *attr, int *nice)
+{
+  *nice = attr->__nice;
+  return 0;
+}
+
+int
+posix_spawnattr_setaffinity_np (posix_spawnattr_t *attr, size_t size,
+				const cpu_set_t *cpuset)
+{
+  attr->__affinity = cpuset;
+  attr->__affinitysize = size;
+  return 0;
+}
+
+int
+posix_spawnattr_getaffinity_np (const posix_spawnattr_t *attr, size_t *size,
+				const cpu_set_t **cpuset)
+{
+  *cpuset = attr->__affinity;
+  *size = attr->__affinitysize;
+  return 0;
+}
@@ -28,7 +28,9 @@
 		   | POSIX_SPAWN_SETSCHEDULER				      \
 		   | POSIX_SPAWN_SETSID					      \
 		   | POSIX_SPAWN_USEVFORK				      \
-		   | POSIX_SPAWN_TCSETPGROUP)
+		   | POSIX_SPAWN_TCSETPGROUP				      \
+		   | POSIX_SPAWN_SETNICE_NP				      \
+		   | POSIX_SPAWN_SETAFFINITY_NP)
 
 /* Store flags in the attribute structure.  */
 int
@@ -133,12 +133,13 @@ _Static_assert (sizeof (posix_spawnattr_t) == 336,
    normal program exit with the exit code 127.  */
 #define SPAWN_ERROR	127
 
+/* __PTID receives the pidfd of the child when CLONE_PIDFD is in __FLAGS.  */
 #ifdef __ia64__
-# define CLONE(__fn, __stackbase, __stacksize, __flags, __args) \
-  __clone2 (__fn, __stackbase, __stacksize, __flags, __args, 0, 0, 0)
+# define CLONE(__fn, __stackbase, __stacksize, __flags, __args, __ptid) \
+  __clone2 (__fn, __stackbase, __stacksize, __flags, __args, __ptid, 0, 0)
 #else
-# define CLONE(__fn, __stack, __stacksize, __flags, __args) \
-  __clone (__fn, __stack, __flags, __args)
+# define CLONE(__fn, __stack, __stacksize, __flags, __args, __ptid) \
+  __clone (__fn, __stack, __flags, __args, __ptid)
 #endif
 
 /* Since ia64 wants the stackbase w/clone2, re-use the grows-up macro.  */
@@ -149,6 +150,115 @@ _Static_assert (sizeof (posix_spawnattr_t) == 336,
 #endif
 
 
+/* Child stacks are cached in a small pool instead of being mapped and
+   unmapped for every spawn.  The parent is suspended until the child has
+   exec'ed or exited (CLONE_VFORK), so a stack is only in use for the
+   duration of one __spawnix call and can be handed to the next one right
+   away.  A cached stack is reused if it is at least as large as needed;
+   when the pool is full the smallest stack is the one given up.  */
+#define SPAWN_STACK_POOL_SIZE	4
+
+struct spawn_stack
+{
+  void *addr;
+  size_t size;
+};
+
+static struct spawn_stack stack_pool[SPAWN_STACK_POOL_SIZE];
+static unsigned long stack_pool_hits, stack_pool_misses;
+static pthread_mutex_t stack_pool_lock = PTHREAD_MUTEX_INITIALIZER;
+
+/* Return a stack of at least SIZE bytes in *STACK, taking it from the
+   pool if possible.  Returns 0 or an errno value.  */
+static int
+spawn_stack_get (struct spawn_stack *stack, size_t size)
+{
+  pthread_mutex_lock (&stack_pool_lock);
+  int best = -1;
+  for (int i = 0; i < SPAWN_STACK_POOL_SIZE; i++)
+    if (stack_pool[i].addr != NULL && stack_pool[i].size >= size
+	&& (best == -1 || stack_pool[i].size < stack_pool[best].size))
+      best = i;
+
+  if (best != -1)
+    {
+      *stack = stack_pool[best];
+      stack_pool[best].addr = NULL;
+      stack_pool_hits++;
+      pthread_mutex_unlock (&stack_pool_lock);
+      return 0;
+    }
+  stack_pool_misses++;
+  pthread_mutex_unlock (&stack_pool_lock);
+
+  int prot = (PROT_READ | PROT_WRITE
+	     | ((GL (dl_stack_flags) & PF_X) ? PROT_EXEC : 0));
+  stack->addr = __mmap (NULL, size, prot,
+			MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
+  if (__glibc_unlikely (stack->addr == MAP_FAILED))
+    return errno;
+  stack->size = size;
+  return 0;
+}
+
+/* Return STACK to the pool, or unmap it (or a smaller cached stack) if
+   the pool is full.  */
+static void
+spawn_stack_put (struct spawn_stack *stack)
+{
+  struct spawn_stack victim = *stack;
+
+  pthread_mutex_lock (&stack_pool_lock);
+  int slot = -1;
+  for (int i = 0; i < SPAWN_STACK_POOL_SIZE; i++)
+    {
+      if (stack_pool[i].addr == NULL)
+	{
+	  slot = i;
+	  break;
+	}
+      if (stack_pool[i].size < victim.size
+	  && (slot == -1 || stack_pool[i].size < stack_pool[slot].size))
+	slot = i;
+    }
+  if (slot != -1)
+    {
+      struct spawn_stack evicted = stack_pool[slot];
+      stack_pool[slot] = victim;
+      victim = evicted;
+    }
+  pthread_mutex_unlock (&stack_pool_lock);
+
+  if (victim.addr != NULL)
+    __munmap (victim.addr, victim.size);
+}
+
+/* Report how many spawns reused a cached stack and how many had to map
+   a new one.  */
+void
+posix_spawn_stack_stats_np (unsigned long *hits, unsigned long *misses)
+{
+  pthread_mutex_lock (&stack_pool_lock);
+  *hits = stack_pool_hits;
+  *misses = stack_pool_misses;
+  pthread_mutex_unlock (&stack_pool_lock);
+}
+
+/* Signals the program has declared to have handlers installed for, see
+   posix_spawn_sethandlers_np.  Until it is called, the child has to ask
+   the kernel about every signal.  */
+static sigset_t handled_signals;
+static bool handlers_tracked;
+
+/* Declare SET as the complete set of signals with handlers installed.  */
+int
+posix_spawn_sethandlers_np (const sigset_t *set)
+{
+  handled_signals = *set;
+  handlers_tracked = true;
+  return 0;
+}
+
 struct posix_spawn_args
 {
   sigset_t oldmask;
@@ -161,6 +271,10 @@ struct posix_spawn_args
   char *const *envp;
   int xflags;
   int err;
+  const char *path;	/* if not NULL, exec'ed before falling back to file */
+  int path_err;		/* set by the child if exec'ing path failed */
+  int pipe_in;		/* if not -1, dup'ed onto stdin */
+  int pipe_out;		/* if not -1, dup'ed onto stdout */
 };
 
 /* Older version requires that shell script without shebang definition
@@ -188,6 +302,18 @@ maybe_script_execute (struct posix_spawn_args *args)
     }
 }
 
+/* Make NEWFD a copy of FD that survives exec.  */
+static int
+__spawn_dup_fd (int fd, int newfd)
+{
+  if (fd == newfd)
+    {
+      int flags = __fcntl (fd, F_GETFD, 0);
+      return flags == -1 ? -1 : __fcntl (fd, F_SETFD, flags & ~FD_CLOEXEC);
+    }
+  return __dup2 (fd, newfd) == newfd ? 0 : -1;
+}
+
 /* Function used in the clone call to setup the signals mask, posix_spawn
    attributes, and file actions.  It run on its own stack (provided by the
    posix_spawn call).  */
@@ -200,15 +326,16 @@ __spawni_child (void *arguments)
 
   /* The child must ensure that no signal handler are enabled because it shared
      memory with parent, so the signal disposition must be either SIG_DFL or
-     SIG_IGN.  It does by iterating over all signals and although it could
-     possibly be more optimized (by tracking which signal potentially have a
-     signal handler), it might requires system specific solutions (since the
-     sigset_t data type can be very different on different architectures).  */
+     SIG_IGN.  If the program has declared which signals it handles
+     (posix_spawn_sethandlers_np), only those need to be reset, which saves
+     two sigaction calls for nearly every signal.  Otherwise it does so by
+     iterating over all signals and asking the kernel about each.  */
   struct sigaction sa;
   memset (&sa, '\0', sizeof (sa));
 
   sigset_t hset;
-  __sigprocmask (SIG_BLOCK, 0, &hset);
+  if (!handlers_tracked)
+    __sigprocmask (SIG_BLOCK, 0, &hset);
   for (int sig = 1; sig < _NSIG; ++sig)
     {
       if ((attr->__flags & POSIX_SPAWN_SETSIGDEF)
@@ -216,6 +343,12 @@ __spawni_child (void *arguments)
 	{
 	  sa.sa_handler = SIG_DFL;
 	}
+      else if (handlers_tracked)
+	{
+	  if (!__sigismember (&handled_signals, sig))
+	    continue;
+	  sa.sa_handler = SIG_DFL;
+	}
       else if (__sigismember (&hset, sig))
 	{
 	  if (__is_internal_signal (sig))
@@ -249,6 +382,15 @@ __spawni_child (void *arguments)
     }
 #endif
 
+  /* Set the nice value and the CPUs the process may run on.  */
+  if ((attr->__flags & POSIX_SPAWN_SETNICE_NP) != 0
+      && setpriority (PRIO_PROCESS, 0, attr->__nice) != 0)
+    goto fail;
+
+  if ((attr->__flags & POSIX_SPAWN_SETAFFINITY_NP) != 0
+      && sched_setaffinity (0, attr->__affinitysize, attr->__affinity) != 0)
+    goto fail;
+
   if ((attr->__flags & POSIX_SPAWN_SETSID) != 0
       && __setsid () < 0)
     goto fail;
@@ -275,6 +417,15 @@ __spawni_child (void *arguments)
 	  || local_setegid (__getgid ()) != 0))
     goto fail;
 
+  /* Connect the pipeline stage to its neighbours.  The pipe ends are
+     close-on-exec, so only the dup'ed copies survive the exec.  */
+  if (args->pipe_in != -1
+      && __spawn_dup_fd (args->pipe_in, STDIN_FILENO) != 0)
+    goto fail;
+  if (args->pipe_out != -1
+      && __spawn_dup_fd (args->pipe_out, STDOUT_FILENO) != 0)
+    goto fail;
+
   /* Execute the file actions.  */
   if (file_actions != 0)
     {
@@ -374,6 +525,12 @@ __spawni_child (void *arguments)
   __sigprocmask (SIG_SETMASK, (attr->__flags & POSIX_SPAWN_SETSIGMASK)
 		 ? &attr->__ss : &args->oldmask, 0);
 
+  if (args->path != NULL)
+    {
+      __execve (args->path, args->argv, args->envp);
+      /* Let the caller know the path is stale before searching FILE.  */
+      args->path_err = errno;
+    }
   args->exec (args->file, args->argv, args->envp);
 
   /* This is compatibility function required to enable posix_spawn run
@@ -391,39 +548,28 @@ fail:
   _exit (SPAWN_ERROR);
 }
 
-/* Spawn a new process executing PATH with the attributes describes in *ATTRP.
-   Before running the process perform the actions described in FILE-ACTIONS. */
+/* Count the arguments in ARGV, including the terminating NULL, into
+   *ARGC.  Returns 0 or E2BIG.  */
 static int
-__spawnix (pid_t * pid, const char *file,
-	   const posix_spawn_file_actions_t * file_actions,
-	   const posix_spawnattr_t * attrp, char *const argv[],
-	   char *const envp[], int xflags,
-	   int (*exec) (const char *, char *const *, char *const *))
+__spawn_count_args (char *const argv[], ptrdiff_t *argc)
 {
-  pid_t new_pid;
-  struct posix_spawn_args args;
-  int ec;
-
-  /* To avoid imposing hard limits on posix_spawn{p} the total number of
-     arguments is first calculated to allocate a mmap to hold all possible
-     values.  */
-  ptrdiff_t argc = 0;
   /* Linux allows at most max (0x7FFFFFFF, 1/4 stack size) arguments
      to be used in a execve call.  We limit to INT_MAX minus one due the
      compatiblity code that may execute a shell script (maybe_script_execute)
      where it will construct another argument list with an additional
      argument.  */
   ptrdiff_t limit = INT_MAX - 1;
-  while (argv[argc++] != NULL)
-    if (argc == limit)
-      {
-	errno = E2BIG;
-	return errno;
-      }
-
-  int prot = (PROT_READ | PROT_WRITE
-	     | ((GL (dl_stack_flags) & PF_X) ? PROT_EXEC : 0));
+  *argc = 0;
+  while (argv[(*argc)++] != NULL)
+    if (*argc == limit)
+      return E2BIG;
+  return 0;
+}
 
+/* Return the size of the child stack needed for ARGC arguments.  */
+static size_t
+__spawn_stack_size (ptrdiff_t argc)
+{
   /* Add a slack area for child's stack.  */
   size_t argv_size = (argc * sizeof (void *)) + 512;
   /* We need at least a few pages in case the compiler's stack checking is
@@ -431,29 +577,23 @@ __spawnix (pid_t * pid, const char *file,
      32KiB to be "safe" from anything the compiler might do.  Besides, the
      extra pages won't actually be allocated unless they get used.  */
   argv_size += (32 * 1024);
-  size_t stack_size = ALIGN_UP (argv_size, GLRO(dl_pagesize));
-  void *stack = __mmap (NULL, stack_size, prot,
-			MAP_PRIVATE | MAP_ANONYMOUS | MAP_STACK, -1, 0);
-  if (__glibc_unlikely (stack == MAP_FAILED))
-    return errno;
+  return ALIGN_UP (argv_size, GLRO(dl_pagesize));
+}
 
-  /* Disable asynchronous cancellation.  */
-  int state;
-  __pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &state);
+/* Start one child running __spawni_child (ARGS) on STACK and wait until it
+   has exec'ed or failed.  The caller must have blocked all signals.
+   Returns 0 or an errno value; on success the new pid (and, if PIDFD is
+   not NULL, a pidfd for it) are stored.  */
+static int
+__spawni_clone (struct posix_spawn_args *args, struct spawn_stack *stack,
+		pid_t *pid, int *pidfd)
+{
+  int ec;
 
   /* Child must set args.err to something non-negative - we rely on
      the parent and child sharing VM.  */
-  args.err = 0;
-  args.file = file;
-  args.exec = exec;
-  args.fa = file_actions;
-  args.attr = attrp ? attrp : &(const posix_spawnattr_t) { 0 };
-  args.argv = argv;
-  args.argc = argc;
-  args.envp = envp;
-  args.xflags = xflags;
-
-  __libc_signal_block_all (&args.oldmask);
+  args->err = 0;
+  args->path_err = 0;
 
   /* The clone flags used will create a new child that will run in the same
      memory space (CLONE_VM) and the execution of calling thread will be
@@ -463,8 +603,11 @@ __spawnix (pid_t * pid, const char *file,
      need for CLONE_SETTLS.  Although parent and child share the same TLS
      namespace, there will be no concurrent access for TLS variables (errno
      for instance).  */
-  new_pid = CLONE (__spawni_child, STACK (stack, stack_size), stack_size,
-		   CLONE_VM | CLONE_VFORK | SIGCHLD, &args);
+  int new_pidfd = -1;
+  pid_t new_pid = CLONE (__spawni_child,
+			 STACK ((char *) stack->addr, stack->size), stack->size,
+			 CLONE_VM | CLONE_VFORK | SIGCHLD
+			 | (pidfd != NULL ? CLONE_PIDFD : 0), args, &new_pidfd);
 
   /* It needs to collect the case where the auxiliary process was created
      but failed to execute the file (due either any preparation step or
@@ -477,7 +620,7 @@ __spawnix (pid_t * pid, const char *file,
 	 only in case of failure, so in case of premature termination
 	 due a signal args.err will remain zeroed and it will be up to
 	 caller to actually collect it.  */
-      ec = args.err;
+      ec = args->err;
       if (ec > 0)
 	/* There still an unlikely case where the child is cancelled after
 	   setting args.err, due to a positive error value.  Also there is
@@ -488,13 +631,72 @@ __spawnix (pid_t * pid, const char *file,
 	__waitpid (new_pid, NULL, 0);
     }
   else
-    ec = -new_pid;
-
-  __munmap (stack, stack_size);
+    ec = errno;
 
   if ((ec == 0) && (pid != NULL))
     *pid = new_pid;
 
+  if (pidfd != NULL)
+    {
+      if (ec == 0)
+	*pidfd = new_pidfd;
+      else if (new_pidfd != -1)
+	__close_nocancel (new_pidfd);
+    }
+
+  return ec;
+}
+
+/* Spawn a new process executing PATH with the attributes describes in *ATTRP.
+   Before running the process perform the actions described in FILE-ACTIONS. */
+static int
+__spawnix (pid_t * pid, const char *file,
+	   const posix_spawn_file_actions_t * file_actions,
+	   const posix_spawnattr_t * attrp, char *const argv[],
+	   char *const envp[], int xflags,
+	   int (*exec) (const char *, char *const *, char *const *))
+{
+  struct posix_spawn_args args;
+  int ec;
+
+  /* To avoid imposing hard limits on posix_spawn{p} the total number of
+     arguments is first calculated to allocate a mmap to hold all possible
+     values.  */
+  ptrdiff_t argc;
+  ec = __spawn_count_args (argv, &argc);
+  if (ec != 0)
+    {
+      errno = ec;
+      return ec;
+    }
+
+  struct spawn_stack child_stack;
+  ec = spawn_stack_get (&child_stack, __spawn_stack_size (argc));
+  if (ec != 0)
+    return ec;
+
+  /* Disable asynchronous cancellation.  */
+  int state;
+  __pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &state);
+
+  args.file = file;
+  args.exec = exec;
+  args.fa = file_actions;
+  args.attr = attrp ? attrp : &(const posix_spawnattr_t) { 0 };
+  args.argv = argv;
+  args.argc = argc;
+  args.envp = envp;
+  args.xflags = xflags;
+  args.path = NULL;
+  args.pipe_in = -1;
+  args.pipe_out = -1;
+
+  __libc_signal_block_all (&args.oldmask);
+
+  ec = __spawni_clone (&args, &child_stack, pid, NULL);
+
+  spawn_stack_put (&child_stack);
+
   __libc_signal_restore_set (&args.oldmask);
 
   __pthread_setcancelstate (state, NULL);
@@ -502,6 +704,118 @@ __spawnix (pid_t * pid, const char *file,
   return ec;
 }
 
+/* Spawn the NSTAGES processes of a pipeline, connecting the standard
+   output of each stage to the standard input of the next.  All stages
+   share one child stack, one signal mask change and one cancellation
+   state change.  A stage that cannot be spawned does not prevent the
+   others from being spawned; its neighbours see end-of-file or EPIPE.  */
+int
+__spawni_pipeline (struct posix_spawn_stage *stages, int nstages,
+		   const posix_spawnattr_t *attrp, char *const envp[])
+{
+  struct posix_spawn_args args;
+  int ec = 0;
+
+  /* One stack, large enough for the longest argument list.  */
+  ptrdiff_t max_argc = 0;
+  for (int i = 0; i < nstages; i++)
+    {
+      ptrdiff_t argc;
+      stages[i].pid = 0;
+      stages[i].pidfd = -1;
+      stages[i].path_err = 0;
+      stages[i].err = __spawn_count_args (stages[i].argv, &argc);
+      if (argc > max_argc)
+	max_argc = argc;
+    }
+
+  struct spawn_stack child_stack;
+  int err = spawn_stack_get (&child_stack, __spawn_stack_size (max_argc));
+  if (err != 0)
+    {
+      for (int i = 0; i < nstages; i++)
+	stages[i].err = err;
+      return err;
+    }
+
+  /* Disable asynchronous cancellation.  */
+  int state;
+  __pthread_setcancelstate (PTHREAD_CANCEL_DISABLE, &state);
+
+  /* Once the first stage is running, the others join its process group
+     (if the caller asked for a new one) and need not take the terminal
+     again.  */
+  posix_spawnattr_t attr = attrp ? *attrp : (posix_spawnattr_t) { 0 };
+  bool have_leader = false;
+
+  args.exec = __execvpex;
+  args.attr = &attr;
+  args.envp = envp;
+  args.xflags = SPAWN_XFLAGS_USE_PATH;
+
+  __libc_signal_block_all (&args.oldmask);
+
+  int pipe_in = -1;
+  for (int i = 0; i < nstages; i++)
+    {
+      struct posix_spawn_stage *stage = &stages[i];
+      int pipefd[2] = { -1, -1 };
+
+      if (i < nstages - 1 && pipe2 (pipefd, O_CLOEXEC) != 0)
+	{
+	  /* Without a pipe the rest of the pipeline cannot run.  */
+	  for (int j = i; j < nstages; j++)
+	    if (stages[j].err == 0)
+	      stages[j].err = errno;
+	  break;
+	}
+      if (pipefd[1] != -1 && attr.__pipesize > 0)
+	/* Best effort: an unprivileged process may not exceed
+	   /proc/sys/fs/pipe-max-size.  */
+	fcntl (pipefd[1], F_SETPIPE_SZ, attr.__pipesize);
+
+      if (stage->err == 0)
+	{
+	  args.file = stage->file;
+	  args.path = stage->path;
+	  args.fa = stage->file_actions;
+	  args.argv = stage->argv;
+	  __spawn_count_args (stage->argv, &args.argc);
+	  args.pipe_in = pipe_in;
+	  args.pipe_out = pipefd[1];
+
+	  stage->err = __spawni_clone (&args, &child_stack, &stage->pid,
+				       &stage->pidfd);
+	  stage->path_err = args.path_err;
+	  if (stage->err == 0 && !have_leader)
+	    {
+	      have_leader = true;
+	      if ((attr.__flags & POSIX_SPAWN_SETPGROUP) && attr.__pgrp == 0)
+		attr.__pgrp = stage->pid;
+	      attr.__flags &= ~POSIX_SPAWN_TCSETPGROUP;
+	    }
+	}
+
+      if (pipe_in != -1)
+	__close_nocancel (pipe_in);
+      if (pipefd[1] != -1)
+	__close_nocancel (pipefd[1]);
+      pipe_in = pipefd[0];
+    }
+  if (pipe_in != -1)
+    __close_nocancel (pipe_in);
+
+  spawn_stack_put (&child_stack);
+
+  __libc_signal_restore_set (&args.oldmask);
+
+  __pthread_setcancelstate (state, NULL);
+
+  for (int i = 0; i < nstages && ec == 0; i++)
+    ec = stages[i].err;
+  return ec;
+}
+
 /* Spawn a new process executing PATH with the attributes describes in *ATTRP.
    Before running the process perform the actions described in FILE-ACTIONS. */
 int
@@ -515,3 +829,4 @@ __spawni (pid_t * pid, const char *file,
   return __spawnix (pid, file, acts, attrp, argv, envp, xflags,
 		    xflags & SPAWN_XFLAGS_USE_PATH ? __execvpex :__execve);
 }
+
@@ -0,0 +1,171 @@
+#!/usr/bin/python3
+#
+# End-to-end benchmark for cush.
+#
+# Runs the shell on a pseudo-terminal (it needs a controlling terminal)
+# and types command lines into it, measuring:
+#
+#  - time-to-exec: from writing a command line until every stage of the
+#    pipeline has started running, for 1-, 5- and 50-stage pipelines.
+#    Each stage is bench/stamp, which reports when it started through a
+#    fifo.
+#  - round trip: from writing a command line until the shell prints its
+#    next prompt, for a builtin (cd .) and for a single external command.
+#  - throughput of "cmd &" storms, in jobs per second: many background
+#    jobs are typed ahead at once and the shell is timed until it has
+#    returned to the prompt after each of them.
+#
+# Usage: bench/cush_bench.py [-s shell-command] [-n samples]
+# (-s 'bash --norc -i' works too, for comparison)
+#
+import argparse, os, pty, select, shlex, shutil, tempfile, time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+STAMP = os.path.join(BENCH_DIR, "stamp")
+PROMPT = b"cush> "
+
+
+class Shell:
+    """A shell running on a pty, driven one command line at a time."""
+
+    def __init__(self, argv, env):
+        self.pid, self.fd = pty.fork()
+        if self.pid == 0:
+            os.execvpe(argv[0], argv, env)
+        self.buf = b""
+        self.wait_prompts(1)
+
+    def send(self, line):
+        os.write(self.fd, line.encode() + b"\n")
+
+    def wait_prompts(self, n):
+        """Read output until n more prompts have been printed."""
+        while n > 0:
+            i = self.buf.find(PROMPT)
+            if i >= 0:
+                self.buf = self.buf[i + len(PROMPT):]
+                n -= 1
+                continue
+            select.select([self.fd], [], [])
+            self.buf += os.read(self.fd, 65536)
+
+    def output_until_prompt(self):
+        """Read and return all output up to the next prompt."""
+        while PROMPT not in self.buf:
+            select.select([self.fd], [], [])
+            self.buf += os.read(self.fd, 65536)
+        out, self.buf = self.buf.split(PROMPT, 1)
+        return out
+
+    def close(self):
+        self.send("exit")
+        os.waitpid(self.pid, 0)
+        os.close(self.fd)
+
+
+class Stamps:
+    """Reads the start times bench/stamp processes write to a fifo."""
+
+    def __init__(self, path):
+        os.mkfifo(path)
+        # O_RDWR: do not see end-of-file between pipelines
+        self.fd = os.open(path, os.O_RDWR)
+        self.buf = b""
+
+    def read(self, n):
+        """Return the latest of the next n stamps, in nanoseconds."""
+        latest = 0
+        while n > 0:
+            if b"\n" not in self.buf:
+                self.buf += os.read(self.fd, 65536)
+                continue
+            line, self.buf = self.buf.split(b"\n", 1)
+            latest = max(latest, int(line))
+            n -= 1
+        return latest
+
+
+def percentiles(samples_ns):
+    s = sorted(samples_ns)
+    return s[len(s) // 2] / 1000, s[min(len(s) - 1, len(s) * 99 // 100)] / 1000
+
+
+def time_to_exec(shell, stamps, nstages, nsamples):
+    line = " | ".join([STAMP] * nstages)
+    samples = []
+    for _ in range(nsamples):
+        start = time.monotonic_ns()
+        shell.send(line)
+        samples.append(stamps.read(nstages) - start)
+        shell.wait_prompts(1)
+    return samples
+
+
+def round_trip(shell, line, nsamples, stamps=None):
+    samples = []
+    for _ in range(nsamples):
+        start = time.monotonic_ns()
+        shell.send(line)
+        shell.wait_prompts(1)
+        samples.append(time.monotonic_ns() - start)
+        if stamps:
+            stamps.read(1)
+    return samples
+
+
+def storm(shell, stamps, njobs):
+    start = time.monotonic_ns()
+    for _ in range(njobs):
+        shell.send(STAMP + " &")
+    shell.wait_prompts(njobs)
+    elapsed = time.monotonic_ns() - start
+    stamps.read(njobs)
+
+    # let the shell reap the storm before going on
+    shell.send("jobs")
+    while b"Running" in shell.output_until_prompt():
+        time.sleep(0.01)
+        shell.send("jobs")
+    return njobs / (elapsed / 1e9)
+
+
+def main():
+    parser = argparse.ArgumentParser(description="cush end-to-end benchmark")
+    parser.add_argument("-s", "--shell",
+                        default=os.path.join(BENCH_DIR, "..", "cush"))
+    parser.add_argument("-n", "--samples", type=int, default=200)
+    args = parser.parse_args()
+
+    tmpdir = tempfile.mkdtemp("-cush-bench")
+    try:
+        env = dict(os.environ, CUSH_BENCH_FIFO=os.path.join(tmpdir, "fifo"),
+                   PS1=PROMPT.decode())
+        stamps = Stamps(env["CUSH_BENCH_FIFO"])
+        shell = Shell(shlex.split(args.shell), env)
+        shell.send("jobs")      # sync up with the first prompt
+        shell.wait_prompts(1)
+
+        n = args.samples
+        print("%-24s %10s %10s" % ("time-to-exec", "p50 us", "p99 us"))
+        for nstages, nsamples in ((1, n), (5, n), (50, max(1, n // 4))):
+            p50, p99 = percentiles(time_to_exec(shell, stamps,
+                                                nstages, nsamples))
+            print("%-24s %10.1f %10.1f" % ("%d-stage pipeline" % nstages,
+                                           p50, p99))
+
+        print("\n%-24s %10s %10s" % ("round trip", "p50 us", "p99 us"))
+        p50, p99 = percentiles(round_trip(shell, "cd .", n))
+        print("%-24s %10.1f %10.1f" % ("builtin (cd .)", p50, p99))
+        p50, p99 = percentiles(round_trip(shell, STAMP, n, stamps))
+        print("%-24s %10.1f %10.1f" % ("external (stamp)", p50, p99))
+
+        njobs = 5 * n
+        print("\n%-24s %10.0f" % ("'stamp &' jobs/sec",
+                                  storm(shell, stamps, njobs)))
+        shell.close()
+    finally:
+        shutil.rmtree(tmpdir)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,61 @@
+#!/usr/bin/python3
+#
+# Glob expansion benchmark for cush.
+#
+# Fills a temporary directory with N empty files and times 
+# "cush -c 'true dir/PATTERN'" for a few patterns, next to /bin/sh doing
+# the same.  The first pattern has no wildcards and gives the baseline;
+# the others all have to scan the whole directory but match different
+# fractions of it.  Each time is the best of several runs, and includes
+# starting the shell and running true (a builtin in most /bin/sh).
+#
+# Usage: bench/glob_bench.py [-s shell] [-n files] [-r runs]
+#
+import argparse, os, shutil, subprocess, tempfile, time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+PATTERNS = ["f0", "f1234?", "f*7", "f[13579]*[02468]"]
+
+
+def best_of(runs, argv):
+    best = None
+    for _ in range(runs):
+        start = time.monotonic()
+        subprocess.run(argv, check=True)
+        elapsed = time.monotonic() - start
+        best = elapsed if best is None else min(best, elapsed)
+    return best
+
+
+def main():
+    parser = argparse.ArgumentParser(description="cush glob expansion")
+    parser.add_argument("-s", "--shell",
+                        default=os.path.join(BENCH_DIR, "..", "cush"))
+    parser.add_argument("-n", "--files", type=int, default=100000)
+    parser.add_argument("-r", "--runs", type=int, default=5)
+    args = parser.parse_args()
+
+    tmpdir = tempfile.mkdtemp("-cush-glob-bench")
+    try:
+        for i in range(args.files):
+            open(os.path.join(tmpdir, "f%d" % i), "w").close()
+
+        print("glob expansion over %d files, best of %d" % (args.files, 
+                                                             args.runs))
+        print("%-20s %10s %10s %10s" % ("pattern", "matches", "cush ms", 
+                                        "sh ms"))
+        for pattern in PATTERNS:
+            line = "true %s/%s" % (tmpdir, pattern)
+            matches = subprocess.run(["/bin/sh", "-c", "echo " + line[5:]],
+                                     check=True, stdout=subprocess.PIPE,
+                                     text=True).stdout.count(" ") + 1
+            cush = best_of(args.runs, [args.shell, "-c", line])
+            sh = best_of(args.runs, ["/bin/sh", "-c", line])
+            print("%-20s %10d %10.1f %10.1f" % (pattern, matches, 
+                                                cush * 1000, sh * 1000))
+    finally:
+        shutil.rmtree(tmpdir)
+
+
+if __name__ == "__main__":
+    main()
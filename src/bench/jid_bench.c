@@ -0,0 +1,107 @@
+/*
+ * Micro-benchmark for job id allocation.
+ *
+ * Creates and deletes 100,000 jobs against the jid_table used by the
+ * shell and against the linear scan over a MAXJOBS-sized array that it
+ * replaced, and reports the average cost of one create/delete pair.
+ * Jobs are kept alive in a sliding window so that freed ids are
+ * scattered through the table the way they are in a busy shell.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "../jid_table.h"
+
+#define MAXJOBS (1<<16)
+#define NJOBS   100000
+
+/* The allocator cush used before jid_table */
+static void *linear_jid2job[MAXJOBS];
+
+static int
+linear_alloc(void *value)
+{
+    for (int i = 1; i < MAXJOBS; i++) {
+        if (linear_jid2job[i] == NULL) {
+            linear_jid2job[i] = value;
+            return i;
+        }
+    }
+    return -1;
+}
+
+static void
+linear_free(int jid)
+{
+    linear_jid2job[jid] = NULL;
+}
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct jid_table table;
+
+static int
+table_alloc(void *value)
+{
+    return jid_table_alloc(&table, value);
+}
+
+static void
+table_free(int jid)
+{
+    jid_table_free(&table, jid);
+}
+
+/* Keep 'window' jobs alive; each step deletes a random live job and
+ * creates a new one.  Returns nanoseconds per create/delete pair. */
+static double
+run(int (*alloc)(void *), void (*free_jid)(int), int window)
+{
+    static int live[MAXJOBS];
+    unsigned seed = 42;
+    int dummy;
+
+    for (int i = 0; i < window; i++)
+        live[i] = alloc(&dummy);
+
+    double start = now();
+    for (int i = 0; i < NJOBS; i++) {
+        int victim = rand_r(&seed) % window;
+        free_jid(live[victim]);
+        live[victim] = alloc(&dummy);
+        if (live[victim] == -1) {
+            fprintf(stderr, "ran out of job ids\n");
+            exit(EXIT_FAILURE);
+        }
+    }
+    double elapsed = now() - start;
+
+    for (int i = 0; i < window; i++)
+        free_jid(live[i]);
+
+    return elapsed * 1e9 / NJOBS;
+}
+
+int
+main(void)
+{
+    static const int windows[] = { 1, 100, 1000, 10000, 60000 };
+
+    jid_table_init(&table, MAXJOBS);
+    printf("%d job create/delete pairs\n", NJOBS);
+    printf("%12s %16s %16s\n", "live jobs", "linear ns/op", "jid_table ns/op");
+    for (int i = 0; i < sizeof windows / sizeof windows[0]; i++) {
+        double linear = run(linear_alloc, linear_free, windows[i]);
+        double bitmap = run(table_alloc, table_free, windows[i]);
+        printf("%12d %16.1f %16.1f\n", windows[i], linear, bitmap);
+    }
+    return 0;
+}
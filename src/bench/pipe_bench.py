@@ -0,0 +1,57 @@
+#!/usr/bin/python3
+#
+# Pipe throughput benchmark for cush.
+#
+# Runs "yes | cat | ... | cat > /dev/null" through "cush -c", once per
+# pipe size given to "set pipesize=N", and reports throughput along with
+# the context switches the pipeline's processes went through.  yes is
+# tests/advanced/yes.c, which pushes 2 GiB into the pipeline.  It is
+# given 1 KiB lines, so that the pipes rather than its fwrite calls are 
+# the bottleneck.
+#
+# Usage: bench/pipe_bench.py [-s shell] [-k stages] [-l line-length] [sizes...]
+#
+import argparse, os, resource, subprocess, time
+
+BENCH_DIR = os.path.dirname(os.path.abspath(__file__))
+YES = os.path.join(BENCH_DIR, "yes")
+BYTES = 2 * 1024 * 1024 * 1024
+
+
+def run(shell, size, nstages, linelen):
+    line = "set pipesize=%s; set; %s %s | %s > /dev/null" % (
+        size, YES, "y" * (linelen - 1), " | ".join(["cat"] * (nstages - 1)))
+    before = resource.getrusage(resource.RUSAGE_CHILDREN)
+    start = time.monotonic()
+    out = subprocess.run([shell, "-c", line], check=True,
+                         stdout=subprocess.PIPE, text=True).stdout
+    elapsed = time.monotonic() - start
+    after = resource.getrusage(resource.RUSAGE_CHILDREN)
+    switches = (after.ru_nvcsw - before.ru_nvcsw
+                + after.ru_nivcsw - before.ru_nivcsw)
+    granted = out.strip().rsplit("pipesize=", 1)[-1]
+    return granted, elapsed, switches
+
+
+def main():
+    parser = argparse.ArgumentParser(description="cush pipe throughput")
+    parser.add_argument("-s", "--shell",
+                        default=os.path.join(BENCH_DIR, "..", "cush"))
+    parser.add_argument("-k", "--stages", type=int, default=4)
+    parser.add_argument("-l", "--line-length", type=int, default=1024)
+    parser.add_argument("sizes", nargs="*", default=["0", "256K", "1M"])
+    args = parser.parse_args()
+
+    print("pipe throughput, %d stages, 2 GiB" % args.stages)
+    print("%10s %10s %10s %12s" % ("pipesize", "seconds", "GiB/s", "ctx switches"))
+    for size in args.sizes:
+        granted, elapsed, switches = run(args.shell, size, args.stages,
+                                         args.line_length)
+        if granted == "0":
+            granted = "default"
+        print("%10s %10.2f %10.2f %12d" % (granted, elapsed,
+                                           BYTES / 2**30 / elapsed, switches))
+
+
+if __name__ == "__main__":
+    main()
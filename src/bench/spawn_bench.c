@@ -0,0 +1,187 @@
+/*
+ * Micro-benchmark for libspawn.
+ *
+ * Launches 1,000 rounds of a 20-stage "pipeline" of /bin/true through
+ * posix_spawnp, the same entry point the shell uses, and reports the
+ * average cost of one spawn.  This is done in two modes: with the child
+ * querying and resetting every signal's disposition, and after
+ * declaring the (empty) set of handled signals with
+ * posix_spawn_sethandlers_np, as the shell does.  Besides wall-clock
+ * time, the system time of the reaped children (getrusage) is shown,
+ * which is where the child's sigaction calls are accounted.
+ *
+ * Each measurement runs in a freshly forked process, since the handler
+ * set cannot be undeclared, and the two modes take turns going first
+ * so that neither profits from the other's warm-up.  The median and
+ * the best of NREPEATS measurements per mode are shown.
+ *
+ * Finally it reports how many spawns reused a cached child stack.
+ * After the first spawn every stack should come from the pool, i.e.
+ * misses should stay at 1 per measurement.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+#include "spawn.h"
+
+#define NROUNDS  1000
+#define NSTAGES  20
+#define NREPEATS 5
+
+struct result {
+    double spawn_us;            /* wall-clock time per spawn */
+    double stime_us;            /* child system time per spawn */
+    unsigned long hits, misses; /* stack cache */
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static double
+children_stime(void)
+{
+    struct rusage ru;
+    getrusage(RUSAGE_CHILDREN, &ru);
+    return ru.ru_stime.tv_sec + ru.ru_stime.tv_usec / 1e6;
+}
+
+/* Spawn NROUNDS pipelines and measure them. */
+static struct result
+run(char *envp[])
+{
+    char *argv[] = { "true", NULL };
+    pid_t pids[NSTAGES];
+    struct result r;
+
+    double stime = children_stime();
+    double start = now();
+    for (int round = 0; round < NROUNDS; round++) {
+        for (int i = 0; i < NSTAGES; i++) {
+            int rc = posix_spawnp(&pids[i], argv[0], NULL, NULL, argv, envp);
+            if (rc != 0) {
+                fprintf(stderr, "posix_spawnp: error %d\n", rc);
+                exit(EXIT_FAILURE);
+            }
+        }
+        for (int i = 0; i < NSTAGES; i++)
+            waitpid(pids[i], NULL, 0);
+    }
+    double elapsed = now() - start;
+    stime = children_stime() - stime;
+
+    r.spawn_us = elapsed * 1e6 / (NROUNDS * NSTAGES);
+    r.stime_us = stime * 1e6 / (NROUNDS * NSTAGES);
+    posix_spawn_stack_stats_np(&r.hits, &r.misses);
+    return r;
+}
+
+/* Run one measurement in a child process, with the handler set declared
+ * if tracked is set. */
+static struct result
+measure(bool tracked, char *envp[])
+{
+    int fds[2];
+    struct result r;
+    if (pipe(fds) == -1) {
+        perror("pipe");
+        exit(EXIT_FAILURE);
+    }
+
+    pid_t pid = fork();
+    if (pid == -1) {
+        perror("fork");
+        exit(EXIT_FAILURE);
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        if (tracked) {
+            sigset_t handled;
+            sigemptyset(&handled);
+            posix_spawn_sethandlers_np(&handled);
+        }
+        r = run(envp);
+        if (write(fds[1], &r, sizeof r) != sizeof r)
+            _exit(EXIT_FAILURE);
+        _exit(EXIT_SUCCESS);
+    }
+
+    close(fds[1]);
+    ssize_t n = read(fds[0], &r, sizeof r);
+    close(fds[0]);
+    int status;
+    waitpid(pid, &status, 0);
+    if (n != sizeof r || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        fprintf(stderr, "measurement failed\n");
+        exit(EXIT_FAILURE);
+    }
+    return r;
+}
+
+static int
+compare_doubles(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+/* Print the median and the best of the NREPEATS results in r. */
+static void
+report(const char *label, const struct result r[])
+{
+    double spawn[NREPEATS], stime[NREPEATS];
+    for (int i = 0; i < NREPEATS; i++) {
+        spawn[i] = r[i].spawn_us;
+        stime[i] = r[i].stime_us;
+    }
+    qsort(spawn, NREPEATS, sizeof spawn[0], compare_doubles);
+    qsort(stime, NREPEATS, sizeof stime[0], compare_doubles);
+    printf("%-24s %8.1f %8.1f %10.1f %8.1f\n", label,
+           spawn[NREPEATS / 2], spawn[0], stime[NREPEATS / 2], stime[0]);
+}
+
+int
+main(int ac, char *av[], char *envp[])
+{
+    struct result all[NREPEATS], tracked[NREPEATS];
+
+    // Alternate which mode goes first
+    for (int i = 0; i < NREPEATS; i++) {
+        if (i % 2 == 0) {
+            all[i] = measure(false, envp);
+            tracked[i] = measure(true, envp);
+        } else {
+            tracked[i] = measure(true, envp);
+            all[i] = measure(false, envp);
+        }
+    }
+
+    printf("%d x %d rounds of %d spawns per mode\n",
+           NREPEATS, NROUNDS, NSTAGES);
+    printf("%-24s %17s %19s\n", "", "us/spawn", "child sys us");
+    printf("%-24s %8s %8s %10s %8s\n", "signal reset",
+           "median", "best", "median", "best");
+    report("all signals", all);
+    report("tracked handlers", tracked);
+
+    unsigned long hits = 0, misses = 0;
+    for (int i = 0; i < NREPEATS; i++) {
+        hits += all[i].hits + tracked[i].hits;
+        misses += all[i].misses + tracked[i].misses;
+    }
+    printf("\n%12s %12s %12s\n", "stack hits", "misses", "hit rate");
+    printf("%12lu %12lu %11.2f%%\n", hits, misses,
+           100.0 * hits / (hits + misses));
+    return 0;
+}
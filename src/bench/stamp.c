@@ -0,0 +1,37 @@
+/*
+ * Pipeline stage for cush_bench.py.
+ *
+ * Writes the CLOCK_MONOTONIC time at which it started running, in
+ * nanoseconds, as one line to the fifo named by $CUSH_BENCH_FIFO and
+ * exits.  Lines are shorter than PIPE_BUF, so the stamps of concurrently
+ * running stages do not interleave.
+ */
+#define _GNU_SOURCE    1
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+int
+main(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    const char *fifo = getenv("CUSH_BENCH_FIFO");
+    if (fifo == NULL)
+        return EXIT_FAILURE;
+
+    int fd = open(fifo, O_WRONLY);
+    if (fd == -1)
+        return EXIT_FAILURE;
+
+    char line[32];
+    int len = snprintf(line, sizeof line, "%lld\n",
+                       ts.tv_sec * 1000000000LL + ts.tv_nsec);
+    if (write(fd, line, len) != len)
+        return EXIT_FAILURE;
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,73 @@
+/*
+ * Perfect-hash lookup of builtin commands by name.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "builtin_table.h"
+#include "utils.h"
+
+/* Seeds tried per table size before the table is doubled */
+#define MAX_SEEDS 1024
+
+/* FNV-1a, started from a seed-dependent basis */
+static uint32_t
+builtin_hash(const char *name, uint32_t seed)
+{
+    uint32_t h = 2166136261u ^ (seed * 0x9e3779b9u);
+    for (const unsigned char *p = (const unsigned char *) name; *p; p++)
+        h = (h ^ *p) * 16777619u;
+    return h ^ (h >> 16);
+}
+
+/* Try to place all builtins under seed, return true if none collide */
+static bool
+try_seed(struct builtin_table *table, const struct builtin *builtins,
+         size_t n, uint32_t seed)
+{
+    memset(table->slots, 0, (table->mask + 1) * sizeof *table->slots);
+    for (size_t i = 0; i < n; i++) {
+        uint32_t slot = builtin_hash(builtins[i].name, seed) & table->mask;
+        if (table->slots[slot] != NULL)
+            return false;
+        table->slots[slot] = &builtins[i];
+    }
+    table->seed = seed;
+    return true;
+}
+
+/* Build a collision-free table for the n builtins in builtins */
+void
+builtin_table_init(struct builtin_table *table,
+                   const struct builtin *builtins, size_t n)
+{
+    /* Start at a load factor of at most 1/2 */
+    size_t size = 1;
+    while (size < 2 * n)
+        size *= 2;
+
+    table->slots = NULL;
+    for (;; size *= 2) {
+        free(table->slots);
+        table->slots = malloc(size * sizeof *table->slots);
+        if (table->slots == NULL)
+            utils_fatal_error("cannot build builtin table: ");
+        table->mask = size - 1;
+
+        for (uint32_t seed = 0; seed < MAX_SEEDS; seed++) {
+            if (try_seed(table, builtins, n, seed))
+                return;
+        }
+    }
+}
+
+/* Return the builtin called name, or NULL if there is none */
+const struct builtin *
+builtin_table_lookup(const struct builtin_table *table, const char *name)
+{
+    const struct builtin *b;
+    b = table->slots[builtin_hash(name, table->seed) & table->mask];
+    return b != NULL && strcmp(b->name, name) == 0 ? b : NULL;
+}
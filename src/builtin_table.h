@@ -0,0 +1,41 @@
+#ifndef __BUILTIN_TABLE_H
+#define __BUILTIN_TABLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/* A perfect-hash table of builtin commands.
+ *
+ * The shell lists its builtins in a static array; builtin_table_init
+ * searches for a hash seed under which every name lands in a slot of
+ * its own.  A lookup then costs one hash of the name and at most one
+ * strcmp, no matter how many builtins there are.  Adding a builtin
+ * means adding an entry to the array; the table adapts on startup.
+ */
+
+/* Runs a builtin with arguments argv, printing its output to out.
+ * Returns its exit status. */
+typedef int (*builtin_fn)(char **argv, FILE *out);
+
+struct builtin {
+    const char *name;
+    builtin_fn run;
+};
+
+struct builtin_table {
+    const struct builtin **slots;   /* NULL marks an empty slot */
+    uint32_t mask;                  /* number of slots - 1 */
+    uint32_t seed;
+};
+
+/* Build a collision-free table for the n builtins in builtins, which
+ * must outlive the table and have distinct names */
+void builtin_table_init(struct builtin_table *table,
+                        const struct builtin *builtins, size_t n);
+
+/* Return the builtin called name, or NULL if there is none */
+const struct builtin *builtin_table_lookup(const struct builtin_table *table,
+                                           const char *name);
+
+#endif /* __BUILTIN_TABLE_H */
@@ -0,0 +1,219 @@
+/*
+ * A hashed table of resolved command paths, used to launch external
+ * commands without probing every PATH directory on each spawn.
+ */
+
+#define _GNU_SOURCE    1
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <unistd.h>
+#include <limits.h>
+#include <sys/stat.h>
+
+#include "cmd_table.h"
+#include "utils.h"
+
+#define CMD_TABLE_MIN_CAPACITY 32
+
+/* Search path execvpe uses when PATH is not set */
+#define DEFAULT_PATH "/bin:/usr/bin"
+
+/* FNV-1a */
+static size_t
+cmd_hash(const char *name, size_t capacity)
+{
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *) name; *p; p++)
+        h = (h ^ *p) * 16777619u;
+    return (size_t) h & (capacity - 1);
+}
+
+/* Initialize an empty table */
+void
+cmd_table_init(struct cmd_table *table)
+{
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+    table->path_env = NULL;
+}
+
+/* Return the slot holding name, or the empty slot where it would go */
+static struct cmd_table_entry *
+find_slot(struct cmd_table *table, const char *name)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = cmd_hash(name, table->capacity);
+    while (table->slots[i].name != NULL && strcmp(table->slots[i].name, name))
+        i = (i + 1) & mask;
+    return &table->slots[i];
+}
+
+/* Double the capacity (or allocate the initial slots) and rehash */
+static void
+grow(struct cmd_table *table)
+{
+    struct cmd_table_entry *old = table->slots;
+    size_t old_capacity = table->capacity;
+
+    table->capacity = old_capacity ? old_capacity * 2 : CMD_TABLE_MIN_CAPACITY;
+    table->slots = calloc(table->capacity, sizeof *table->slots);
+    if (table->slots == NULL)
+        utils_fatal_error("cannot grow command table: ");
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].name != NULL)
+            *find_slot(table, old[i].name) = old[i];
+    }
+    free(old);
+}
+
+/* Forget all entries */
+void
+cmd_table_clear(struct cmd_table *table)
+{
+    for (size_t i = 0; i < table->capacity; i++) {
+        free(table->slots[i].name);
+        free(table->slots[i].path);
+    }
+    free(table->slots);
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+/* Empty the table if PATH changed since its entries were resolved */
+static void
+check_path(struct cmd_table *table)
+{
+    const char *path_env = getenv("PATH");
+    if (path_env == table->path_env
+        || (path_env && table->path_env && !strcmp(path_env, table->path_env)))
+        return;
+
+    cmd_table_clear(table);
+    free(table->path_env);
+    table->path_env = path_env ? strdup(path_env) : NULL;
+}
+
+/* Is file an executable regular file? */
+static bool
+is_executable(const char *file)
+{
+    struct stat st;
+    return stat(file, &st) == 0 && S_ISREG(st.st_mode)
+        && access(file, X_OK) == 0;
+}
+
+/* Search PATH for name, the way execvpe would.  Returns true and stores
+ * the path in buf if the first match lies in an absolute directory. */
+static bool
+search_path(const char *name, char *buf)
+{
+    const char *dir = getenv("PATH");
+    if (dir == NULL)
+        dir = DEFAULT_PATH;
+
+    size_t namelen = strlen(name);
+    for (;;) {
+        const char *end = strchrnul(dir, ':');
+        size_t dirlen = end - dir;
+
+        /* An empty element stands for the current directory */
+        if (dirlen + 1 + namelen < PATH_MAX) {
+            if (dirlen > 0) {
+                memcpy(buf, dir, dirlen);
+                buf[dirlen] = '/';
+                memcpy(buf + dirlen + 1, name, namelen + 1);
+            } else {
+                memcpy(buf, name, namelen + 1);
+            }
+            if (is_executable(buf))
+                return dir[0] == '/';
+        }
+
+        if (*end == '\0')
+            break;
+        dir = end + 1;
+    }
+    return false;
+}
+
+/* Return the absolute path name runs as, searching PATH and remembering
+ * the result on a miss. */
+const char *
+cmd_table_resolve(struct cmd_table *table, const char *name)
+{
+    if (strchr(name, '/') != NULL || name[0] == '\0')
+        return NULL;
+
+    check_path(table);
+    if (table->count > 0) {
+        struct cmd_table_entry *slot = find_slot(table, name);
+        if (slot->name != NULL) {
+            slot->hits++;
+            return slot->path;
+        }
+    }
+
+    char buf[PATH_MAX];
+    if (!search_path(name, buf))
+        return NULL;
+
+    /* Keep the load factor at or below 1/2 */
+    if (2 * (table->count + 1) > table->capacity)
+        grow(table);
+
+    struct cmd_table_entry *slot = find_slot(table, name);
+    slot->name = strdup(name);
+    slot->path = strdup(buf);
+    slot->hits = 1;
+    if (slot->name == NULL || slot->path == NULL)
+        utils_fatal_error("cannot add to command table: ");
+    table->count++;
+    return slot->path;
+}
+
+/* Forget the entry for name */
+void
+cmd_table_forget(struct cmd_table *table, const char *name)
+{
+    if (table->count == 0)
+        return;
+
+    size_t mask = table->capacity - 1;
+    struct cmd_table_entry *slot = find_slot(table, name);
+    if (slot->name == NULL)
+        return;
+
+    free(slot->name);
+    free(slot->path);
+    table->count--;
+
+    /* Backward-shift deletion, as in pid_table_remove */
+    size_t hole = slot - table->slots;
+    for (size_t i = (hole + 1) & mask; table->slots[i].name != NULL;
+         i = (i + 1) & mask) {
+        size_t home = cmd_hash(table->slots[i].name, table->capacity);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->slots[hole] = table->slots[i];
+            hole = i;
+        }
+    }
+    table->slots[hole].name = NULL;
+    table->slots[hole].path = NULL;
+    table->slots[hole].hits = 0;
+}
+
+/* Print one "hits<TAB>path" line per entry to out */
+void
+cmd_table_print(struct cmd_table *table, FILE *out)
+{
+    for (size_t i = 0; i < table->capacity; i++) {
+        if (table->slots[i].name != NULL)
+            fprintf(out, "%4lu\t%s\n", table->slots[i].hits,
+                    table->slots[i].path);
+    }
+}
@@ -0,0 +1,46 @@
+#ifndef __CMD_TABLE_H
+#define __CMD_TABLE_H
+
+#include <stddef.h>
+#include <stdio.h>
+
+/* A hash table remembering where commands were found on PATH.
+ *
+ * Maps a command name to the absolute path of the executable that
+ * a PATH search found for it, so that running the same command again
+ * costs one lookup instead of one failed execve per PATH directory.
+ * The table remembers the PATH value its entries were resolved
+ * against and empties itself as soon as PATH changes.
+ */
+struct cmd_table_entry {
+    char *name;              /* NULL marks an empty slot */
+    char *path;
+    unsigned long hits;      /* number of times this entry was used */
+};
+
+struct cmd_table {
+    struct cmd_table_entry *slots;
+    size_t capacity;         /* always 0 or a power of two */
+    size_t count;
+    char *path_env;          /* PATH the entries were resolved against */
+};
+
+/* Initialize an empty table */
+void cmd_table_init(struct cmd_table *table);
+
+/* Return the absolute path name runs as, searching PATH and remembering
+ * the result on a miss.  Returns NULL if name contains a slash, was not
+ * found, or was found through a relative PATH entry (which depends on
+ * the working directory and is therefore never cached). */
+const char *cmd_table_resolve(struct cmd_table *table, const char *name);
+
+/* Forget the entry for name, e.g. after spawning its path failed */
+void cmd_table_forget(struct cmd_table *table, const char *name);
+
+/* Forget all entries */
+void cmd_table_clear(struct cmd_table *table);
+
+/* Print one "hits<TAB>path" line per entry to out */
+void cmd_table_print(struct cmd_table *table, FILE *out);
+
+#endif /* __CMD_TABLE_H */
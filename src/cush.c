@@ -16,24 +16,44 @@
 #include <string.h>
 #include <termios.h>
 #include <sys/wait.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <sys/sendfile.h>
+#include <sys/timerfd.h>
+#include <time.h>
 #include <assert.h>
 
 #include <fcntl.h>
 #include <signal.h>
 #include <errno.h>
+#include <poll.h>
+#include <limits.h>
+#include <math.h>
 
 /* Since the handed out code contains a number of unused functions. */
 #pragma GCC diagnostic ignored "-Wunused-function"
 
 #include "termstate_management.h"
 #include "signal_support.h"
+#include "event_loop.h"
 #include "shell-ast.h"
 #include "utils.h"
+#include "pid_table.h"
+#include "jid_table.h"
+#include "cmd_table.h"
+#include "builtin_table.h"
+#include "parse_cache.h"
+#include "notify_queue.h"
+#include "glob_expand.h"
+#include "line_reader.h"
 #include "../posix_spawn/spawn.h"
 #include "readline/history.h"
 
 
-static void handle_child_status(pid_t pid, int status);
+static void handle_child_status(pid_t pid, int status, 
+                                const struct rusage *usage);
+static void start_queued_jobs(void);
 
 HIST_ENTRY **the_history_list;
 
@@ -43,8 +63,10 @@ HIST_ENTRY **the_history_list;
  * Prints a message to stdout describing how to invoke this program.
  */
 static void usage(char *progname) {
-    printf("Usage: %s -h\n"
-        " -h            print this help\n",
+    printf("Usage: %s [-h] [-c command | script]\n"
+        " -h            print this help\n"
+        " -c command    run command and exit\n"
+        " script        run the commands in file script and exit\n",
         progname);
 
     exit(EXIT_SUCCESS);
@@ -72,21 +94,26 @@ enum job_status {
                        and requires exclusive terminal access */
 
     /* I added this */
-    TERMINATED      /* all processes have terminated */
+    TERMINATED,     /* all processes have terminated */
+    QUEUED          /* background job waiting for a slot, see jobs_max */
 };
 
 
 
 /* process status enum
-   I don't think we need a TERMINATED status: when a process is terminated
-   it will just be removed from the procs array. */
+   A terminated process keeps its slot in the procs array (marked
+   PSTAT_TERMINATED) so that reaping it is O(1) and pointers to the other
+   processes in the job stay valid. */
 enum proc_status {
     PSTAT_RUNNING,
-    PSTAT_STOPPED
+    PSTAT_STOPPED,
+    PSTAT_TERMINATED
 };
 
 
 
+struct job;
+
 /**
  * process struct
  */
@@ -95,16 +122,49 @@ typedef struct process {
     /* pid: Process' pid. */
     pid_t pid;
 
+    /* job: The job this process belongs to. */
+    struct job *job;
+
+    /* pidfd: File descriptor referring to this process. It becomes 
+              readable once the process has exited. Closed when the 
+              process is reaped. */
+    int pidfd;
+
     /* status: Is this process running or stopped? */
     enum proc_status status;
 
     /* the command used to spawn this process */
     struct ast_command *command;
 
+    /* started: When the process was spawned (CLOCK_MONOTONIC). */
+    struct timespec started;
+
+    /* ended: When the process was reaped. Valid once it is terminated. */
+    struct timespec ended;
+
+    /* wait_status: The status the process was reaped with. */
+    int wait_status;
+
+    /* usage: The CPU time and memory the process used, as reported when
+              it was reaped. Zero while it is alive. */
+    struct rusage usage;
+
 } process_t;
 
 
 
+/* spawn_options: How the processes of a job are to be scheduled, as set
+                  by the "nice", "sched" and "affinity" prefixes. */
+struct spawn_options {
+    bool set_nice;
+    int nice;               /* absolute nice value */
+    int policy;             /* scheduling policy, or -1 to inherit */
+    bool set_affinity;
+    cpu_set_t cpus;         /* the CPUs the processes may run on */
+};
+
+
+
 /**
  * job struct
  */
@@ -136,17 +196,64 @@ struct job {
     pid_t pgid;
 
     /* procs: Pointer to heap-allocated array of process_t structs. There will
-              be one entry in this array for each alive process in the job.
-              This will have to be adjusted (memmove) each time a process dies.
-              num_processes_alive can be used as the size of this array. */
+              be one entry in this array for each process spawned for the 
+              job. Entries never move: when a process dies its slot is just
+              marked PSTAT_TERMINATED. */
     process_t *procs;
+
+    /* num_procs: The number of slots used in procs (alive or not). */
+    int num_procs;
+
+    /* term_signal: The signal that killed the job's last process to be
+                    killed by one, or 0 if none was. */
+    int term_signal;
+
+    /* has_slot: True if this job counts against jobs_max. */
+    bool has_slot;
+
+    /* queue_elem: Link element for job_queue while the job is QUEUED. */
+    struct list_elem queue_elem;
+
+    /* envp: The environment a QUEUED job will be spawned with. */
+    char **envp;
+
+    /* batch: The items still to be run if this job was started by 
+              "parallel", NULL otherwise. */
+    struct parallel_batch *batch;
+
+    /* timeout, grace: How long the job may run before it is sent SIGTERM,
+                       and how much longer before it is sent SIGKILL, in
+                       seconds. A timeout of 0 means no limit. */
+    double timeout, grace;
+
+    /* timer_fd: A timerfd that expires when the job's time is up (or its
+                 grace period is over), or -1 if no timeout is armed. */
+    int timer_fd;
+
+    /* timed_out: True once the job has been sent SIGTERM for running past
+                  its timeout. */
+    bool timed_out;
+
+    /* spawn_opts: Applied to every process the job spawns, including 
+                   those of QUEUED and parallel jobs that are spawned 
+                   later. */
+    struct spawn_options spawn_opts;
 };
 
+static bool start_job(struct job *job, bool take_slot);
+static void parallel_refill(struct job *job);
+static struct job *run_pipeline_commands(struct ast_pipeline *pipeline,
+                                         struct job *job, char *envp[],
+                                         const struct spawn_options *opts);
+static void parallel_reap(struct job *job, process_t *proc, int status);
+static void parallel_batch_free(struct parallel_batch *batch);
+static void job_timer_ready(int fd, void *data);
+
 
 
 /* Utility functions for job list management.
  * We use 2 data structures: 
- * (a) an array jid2job to quickly find a job based on its id
+ * (a) a table jid2job to quickly find a job based on its id
  * (b) a linked list to support iteration
  */
 #define MAXJOBS (1<<16)
@@ -157,9 +264,123 @@ struct job {
 static struct list job_list;
 
 
-/* jid2job: Big array containing a pointer to the job struct for each active 
-            job. jid2job[n] will point to the job struct for job w/ jid n. */
-static struct job *jid2job[MAXJOBS];
+/* job_queue: Background jobs waiting for a slot, oldest first. */
+static struct list job_queue;
+
+
+/* jid2job: Table containing a pointer to the job struct for each active 
+            job, indexed by jid. It hands out the lowest free jid in 
+            constant time and only grows as far as the highest jid in use. */
+static struct jid_table jid2job;
+
+
+/* pid2proc: Maps the pid of every process we know to be alive to its
+             process_t, so a status change can be dispatched without
+             searching the job list. Entries point into job->procs, which
+             never moves while the job exists. */
+static struct pid_table pid2proc;
+
+
+/* cmd_hash_table: Remembers the absolute path each external command was
+                   found at, so it can be spawned without a PATH search. 
+                   Listed and cleared by the hash builtin. */
+static struct cmd_table cmd_hash_table;
+
+
+/* builtin_table: Finds the builtin, if any, that a command name refers to
+                  with a single hash probe. Built on startup from the
+                  builtins array. */
+static struct builtin_table builtin_table;
+
+
+/* parse_cache: Parsed trees of recently run command lines, so repeating
+                a line skips the lexer and parser.  Its hit and miss 
+                counts are shown by "hash -s". */
+static struct parse_cache parse_cache;
+
+
+/* notifications: Reports of jobs that stopped, finished, or were killed,
+                  held until the shell is about to print its next prompt
+                  and then written out in one go. */
+static struct notify_queue notifications;
+
+
+/* last_job: The job that was deleted most recently, kept around (with its
+             processes' resource usage) so that "times" can show it. */
+static struct job *last_job;
+
+
+/* pipe_size: Capacity of every pipe the shell creates between pipeline
+              stages, or 0 for the kernel's default. Set with 
+              "set pipesize=N". */
+static int pipe_size;
+
+
+/* jobs_max: The number of background jobs that may run at once, or 0 for
+             no limit. Jobs started with & beyond it are QUEUED until a 
+             slot frees up. Set with "set jobs_max=N". */
+static int jobs_max;
+
+
+/* timeout_grace: The default number of seconds a job that ran out of time
+                  is given to exit after SIGTERM before it is sent 
+                  SIGKILL. */
+#define TIMEOUT_GRACE 5.0
+
+
+/* timeout_max: Longer durations are cut down to this many seconds (about
+                68 years), which fits into the time_t of a timer. */
+#define TIMEOUT_MAX ((double) INT_MAX)
+
+
+/* num_timers: The number of jobs with an armed timer_fd. wait_for_job 
+               watches those timers as well, since bg jobs may time out 
+               while a fg job is running. */
+static int num_timers;
+
+
+/* jobs_running: The number of jobs holding a slot. A background job takes
+                 one when it is spawned and keeps it, even if it is 
+                 stopped or moved to the foreground, until it is deleted. */
+static int jobs_running;
+
+
+/* exiting: Set once exit_shell has begun killing jobs. No queued job or 
+            parallel item is started after that. */
+static bool exiting;
+
+
+/* num_batches: The number of jobs started by "parallel" that still exist.
+                Their items are started as earlier ones are reaped, so 
+                while there are any, every child is reaped as it exits. */
+static int num_batches;
+
+
+/* builtin_output: Output of one builtin in a pipeline. Builtins print into
+                  an in-memory stream, which is then written to fd with 
+                  as few write calls as possible. */
+struct builtin_output {
+    FILE *stream;
+    char *buf;
+    size_t len;
+    size_t done;            /* bytes written so far */
+    int fd;
+    struct list_elem elem;  /* in pending_outputs */
+};
+
+
+/* pending_outputs: Builtin output that did not fit into its pipe yet. 
+                    wait_for_job watches these pipes as well, since their 
+                    readers may be part of the fg job. */
+static struct list pending_outputs;
+static void builtin_output_ready(int fd, void *data);
+
+
+/* interactive: True if the shell reads commands from a terminal and does 
+                job control. Scripts (cush file, cush -c, or input that is
+                not a terminal) run without touching the terminal, and 
+                their jobs share the shell's process group. */
+static bool interactive;
 
 
 
@@ -168,10 +389,338 @@ static struct job *jid2job[MAXJOBS];
  * Return job corresponding to jid 
  */
 static struct job *get_job_from_jid(int jid) {
-    if (jid > 0 && jid < MAXJOBS && jid2job[jid] != NULL)
-        return jid2job[jid];
+    return jid_table_get(&jid2job, jid);
+}
 
-    return NULL;
+
+
+/**
+ * signal_job
+ * Sends sig to all processes of job. Interactive jobs have a process group
+ * of their own; without job control, each process is signaled separately.
+ */
+static void signal_job(struct job *job, int sig) {
+    if (job->num_procs == 0)    // QUEUED, there is no one to signal yet
+        return;
+    if (interactive) {
+        kill(-1 * job->pgid, sig);
+        return;
+    }
+    for (int i = 0; i < job->num_procs; i++) {
+        if (job->procs[i].status != PSTAT_TERMINATED)
+            kill(job->procs[i].pid, sig);
+    }
+}
+
+
+
+/**
+ * parse_duration
+ * Parses a number of seconds, optionally followed by s, m, h or d, the
+ * way timeout(1) does. Durations beyond TIMEOUT_MAX are clamped to it, 
+ * as timeout(1) clamps them to what its timer can hold.
+ * Return Value: Non-zero (true) if str is a valid, non-negative duration.
+ */
+static bool parse_duration(const char *str, double *seconds) {
+    char *end;
+    errno = 0;
+    double value = strtod(str, &end);
+    if (end == str || errno != 0 || !isfinite(value) || value < 0)
+        return false;
+
+    switch (*end) {
+    case 'd':
+        value *= 24;
+        /* fall through */
+    case 'h':
+        value *= 60;
+        /* fall through */
+    case 'm':
+        value *= 60;
+        /* fall through */
+    case 's':
+        end++;
+        break;
+    }
+    if (*end != '\0')
+        return false;
+    *seconds = value < TIMEOUT_MAX ? value : TIMEOUT_MAX;
+    return true;
+}
+
+
+
+/**
+ * parse_timeout_prefix
+ * Parses the arguments of a "timeout [-k GRACE] SECS" prefix.
+ * Return Value: The number of words the prefix takes, or 0 if argv is not
+ *               such a prefix.
+ */
+static int parse_timeout_prefix(char **argv, double *timeout, double *grace) {
+    int n = 1;
+    double g = TIMEOUT_GRACE, t;
+    if (argv[n] != NULL && !strcmp(argv[n], "-k")) {
+        if (argv[n + 1] == NULL || !parse_duration(argv[n + 1], &g))
+            return 0;
+        n += 2;
+    }
+    if (argv[n] == NULL || !parse_duration(argv[n], &t))
+        return 0;
+    *timeout = t;
+    *grace = g;
+    return n + 1;
+}
+
+
+
+/**
+ * parse_nice_prefix
+ * Parses the arguments of a "nice [-n] N" prefix. Like nice(1), N is 
+ * added to the shell's own nice value, or to that of an earlier nice 
+ * prefix.
+ * Return Value: The number of words the prefix takes, or 0 if argv is not
+ *               such a prefix.
+ */
+static int parse_nice_prefix(char **argv, struct spawn_options *opts) {
+    int n = 1;
+    if (argv[n] != NULL && !strcmp(argv[n], "-n"))
+        n++;
+    if (argv[n] == NULL)
+        return 0;
+
+    char *end;
+    errno = 0;
+    long adjustment = strtol(argv[n], &end, 10);
+    if (*argv[n] == '\0' || *end != '\0' || errno != 0)
+        return 0;
+
+    long nice = opts->nice;
+    if (!opts->set_nice) {
+        errno = 0;
+        nice = getpriority(PRIO_PROCESS, 0);
+        if (nice == -1 && errno != 0)
+            return 0;
+    }
+    if (adjustment > 40)        // keep the sum from overflowing
+        adjustment = 40;
+    if (adjustment < -40)
+        adjustment = -40;
+    nice += adjustment;
+    opts->nice = nice < -20 ? -20 : nice > 19 ? 19 : nice;
+    opts->set_nice = true;
+    return n + 1;
+}
+
+
+
+/* sched_policies: The policies the sched prefix knows by name. */
+static const struct {
+    const char *name;
+    int policy;
+} sched_policies[] = {
+    { "other", SCHED_OTHER },
+    { "batch", SCHED_BATCH },
+    { "idle", SCHED_IDLE },
+    { "fifo", SCHED_FIFO },
+    { "rr", SCHED_RR },
+};
+
+
+
+/**
+ * parse_sched_prefix
+ * Parses the arguments of a "sched POLICY" prefix.
+ * Return Value: The number of words the prefix takes, or 0 if argv is not
+ *               such a prefix.
+ */
+static int parse_sched_prefix(char **argv, struct spawn_options *opts) {
+    if (argv[1] == NULL)
+        return 0;
+    for (size_t i = 0; i < sizeof sched_policies / sizeof *sched_policies; 
+         i++) {
+        if (!strcmp(argv[1], sched_policies[i].name)) {
+            opts->policy = sched_policies[i].policy;
+            return 2;
+        }
+    }
+    return 0;
+}
+
+
+
+/**
+ * parse_affinity_prefix
+ * Parses the arguments of an "affinity CPUS" prefix, where CPUS is a list
+ * such as 0-3,8,10-11.
+ * Return Value: The number of words the prefix takes, or 0 if argv is not
+ *               such a prefix.
+ */
+static int parse_affinity_prefix(char **argv, struct spawn_options *opts) {
+    if (argv[1] == NULL)
+        return 0;
+
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    for (const char *p = argv[1]; ; p++) {
+        char *end;
+        long first = strtol(p, &end, 10), last = first;
+        if (end == p || *p == '-' || *p == '+')
+            return 0;
+        p = end;
+        if (*p == '-') {
+            last = strtol(p + 1, &end, 10);
+            if (end == p + 1 || p[1] == '-' || p[1] == '+')
+                return 0;
+            p = end;
+        }
+        if (first > last || last >= CPU_SETSIZE)
+            return 0;
+        for (long cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, &cpus);
+
+        if (*p == '\0')
+            break;
+        if (*p != ',')
+            return 0;
+    }
+    opts->cpus = cpus;
+    opts->set_affinity = true;
+    return 2;
+}
+
+
+
+/**
+ * strip_prefixes
+ * Recognizes the "timeout", "nice", "sched" and "affinity" prefixes, in 
+ * any order, at the start of the first command of pipeline and removes
+ * them. The time limits go to *timeout and *grace, everything else to 
+ * *opts. A prefix that does not parse, or that is not followed by a 
+ * command, is left alone, so the program of that name runs instead.
+ */
+static void strip_prefixes(struct ast_pipeline *pipeline, 
+                           double *timeout, double *grace, 
+                           struct spawn_options *opts) {
+    struct ast_command *command = list_entry(list_front(&pipeline->commands),
+                                             struct ast_command, elem);
+    char **argv = command->argv;
+    int n = 0;
+    for (;;) {
+        double t, g;
+        struct spawn_options o = *opts;
+        int used = 0;
+        if (!strcmp(argv[n], "timeout"))
+            used = parse_timeout_prefix(&argv[n], &t, &g);
+        else if (!strcmp(argv[n], "nice"))
+            used = parse_nice_prefix(&argv[n], &o);
+        else if (!strcmp(argv[n], "sched"))
+            used = parse_sched_prefix(&argv[n], &o);
+        else if (!strcmp(argv[n], "affinity"))
+            used = parse_affinity_prefix(&argv[n], &o);
+        if (used == 0 || argv[n + used] == NULL)
+            break;
+
+        if (!strcmp(argv[n], "timeout")) {
+            *timeout = t;
+            *grace = g;
+        }
+        *opts = o;
+        n += used;
+    }
+
+    command->argv += n;
+    if (command->glob_words != NULL)
+        command->glob_words += n;
+}
+
+
+
+/**
+ * clear_timer
+ * Disarms job's timer and releases its timerfd.
+ */
+static void clear_timer(struct job *job) {
+    if (job->timer_fd == -1)
+        return;
+    event_loop_remove(job->timer_fd);
+    close(job->timer_fd);
+    job->timer_fd = -1;
+    num_timers--;
+}
+
+
+
+/**
+ * set_timer
+ * Makes job's timer expire once, seconds from now. Creates the timerfd and
+ * has the event loop watch it if the job has none yet. If the timer 
+ * cannot be set, the job is left without one rather than with its old
+ * deadline.
+ */
+static void set_timer(struct job *job, double seconds) {
+    if (job->timer_fd == -1) {
+        job->timer_fd = timerfd_create(CLOCK_MONOTONIC, 
+                                       TFD_CLOEXEC | TFD_NONBLOCK);
+        if (job->timer_fd == -1)
+            utils_fatal_error("cannot create job timer: ");
+        event_loop_add(job->timer_fd, job_timer_ready, job);
+        num_timers++;
+    }
+
+    struct itimerspec spec = { 0 };
+    spec.it_value.tv_sec = seconds;
+    spec.it_value.tv_nsec = (seconds - spec.it_value.tv_sec) * 1e9;
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0)
+        spec.it_value.tv_nsec = 1;      // all zeros would disarm it
+    if (timerfd_settime(job->timer_fd, 0, &spec, NULL) == -1) {
+        utils_error("cannot set job timer: ");
+        clear_timer(job);
+    }
+}
+
+
+
+/**
+ * arm_timeout
+ * Starts the clock on job's timeout, if it has one. 
+ */
+static void arm_timeout(struct job *job) {
+    if (job->timeout > 0)
+        set_timer(job, job->timeout);
+    else
+        clear_timer(job);
+}
+
+
+
+/**
+ * job_timer_expired
+ * Called when job's timer goes off: sends SIGTERM the first time, and 
+ * SIGKILL if the job is still around after its grace period. Stopped 
+ * jobs are continued so that the signal is acted upon.
+ */
+static void job_timer_expired(struct job *job) {
+    uint64_t expirations;
+    if (read(job->timer_fd, &expirations, sizeof expirations) < 0)
+        return;                         // spurious wakeup
+
+    if (!job->timed_out) {
+        job->timed_out = true;
+        signal_job(job, SIGTERM);
+        signal_job(job, SIGCONT);
+        set_timer(job, job->grace);
+    }
+    else {
+        signal_job(job, SIGKILL);
+        clear_timer(job);
+    }
+}
+
+
+
+/* Event loop handler for a job's timerfd */
+static void job_timer_ready(int fd, void *data) {
+    job_timer_expired(data);
 }
 
 
@@ -188,18 +737,39 @@ static struct job *get_job_from_jid(int jid) {
 static struct job *add_job(struct ast_pipeline *pipe) {
     struct job *job = malloc(sizeof *job);
     job->pipe = pipe;
+    ast_pipeline_retain(pipe);
     job->num_processes_alive = 0;
+    job->term_signal = 0;
+    job->has_slot = false;
+    job->procs = NULL;
+    job->num_procs = 0;
+    job->batch = NULL;
+    job->timeout = 0;
+    job->grace = TIMEOUT_GRACE;
+    job->timer_fd = -1;
+    job->timed_out = false;
+    job->spawn_opts.set_nice = false;
+    job->spawn_opts.policy = -1;
+    job->spawn_opts.set_affinity = false;
     list_push_back(&job_list, &job->elem);
-    for (int i = 1; i < MAXJOBS; i++) {
-        if (jid2job[i] == NULL) {
-            jid2job[i] = job;
-            job->jid = i;
-            return job;
-        }
+    job->jid = jid_table_alloc(&jid2job, job);
+    if (job->jid == -1) {
+        fprintf(stderr, "Maximum number of jobs exceeded\n");
+        abort();
     }
-    fprintf(stderr, "Maximum number of jobs exceeded\n");
-    abort();
-    return NULL;
+    return job;
+}
+
+
+
+/**
+ * free_job
+ * Releases the memory of a job that delete_job has retired.
+ */
+static void free_job(struct job *job) {
+    free(job->procs);
+    ast_pipeline_free(job->pipe);
+    free(job);
 }
 
 
@@ -209,14 +779,36 @@ static struct job *add_job(struct ast_pipeline *pipe) {
  * Delete a job.
  * This should be called only when all processes that were
  * forked for this job are known to have terminated.
+ * The job is removed from jid2job and pid2proc but stays in memory as
+ * last_job until the next job is deleted.
  */
 static void delete_job(struct job *job) {
     int jid = job->jid;
     assert(jid != -1);
-    jid2job[jid]->jid = -1;
-    jid2job[jid] = NULL;
-    ast_pipeline_free(job->pipe);
-    free(job);
+    for (int i = 0; i < job->num_procs; i++) {
+        if (job->procs[i].status != PSTAT_TERMINATED) {
+            pid_table_remove(&pid2proc, job->procs[i].pid);
+            close(job->procs[i].pidfd);
+        }
+    }
+    job->jid = -1;
+    jid_table_free(&jid2job, jid);
+    if (job->status == QUEUED)
+        list_remove(&job->queue_elem);
+    if (job->batch) {
+        parallel_batch_free(job->batch);
+        job->batch = NULL;
+        num_batches--;
+    }
+    clear_timer(job);
+    if (last_job)
+        free_job(last_job);
+    last_job = job;
+
+    if (job->has_slot) {
+        jobs_running--;
+        start_queued_jobs();
+    }
 }
 
 
@@ -235,6 +827,8 @@ static const char *get_status(enum job_status status) {
         return "Stopped";
     case NEEDSTERMINAL:
         return "Stopped (tty)";
+    case QUEUED:
+        return "Queued";
     default:
         return "Unknown";
     }
@@ -244,17 +838,17 @@ static const char *get_status(enum job_status status) {
 
 /* Print the command line that belongs to one job. */
 static void
-print_cmdline(struct ast_pipeline *pipeline)
+print_cmdline(struct ast_pipeline *pipeline, FILE *out)
 {
     struct list_elem * e = list_begin (&pipeline->commands); 
     for (; e != list_end (&pipeline->commands); e = list_next(e)) {
         struct ast_command *cmd = list_entry(e, struct ast_command, elem);
         if (e != list_begin(&pipeline->commands))
-            printf("| ");
+            fprintf(out, "| ");
         char **p = cmd->argv;
-        printf("%s", *p++);
+        fprintf(out, "%s", *p++);
         while (*p)
-            printf(" %s", *p++);
+            fprintf(out, " %s", *p++);
     }
 }
 
@@ -262,42 +856,234 @@ print_cmdline(struct ast_pipeline *pipeline)
 
 /* Print a job */
 static void
-print_job(struct job *job)
+print_job(struct job *job, FILE *out)
 {
-    printf("[%d]\t%s\t\t(", job->jid, get_status(job->status));
-    print_cmdline(job->pipe);
-    printf(")\n");
+    fprintf(out, "[%d]\t%s\t\t(", job->jid, get_status(job->status));
+    print_cmdline(job->pipe, out);
+    fprintf(out, ")\n");
+}
+
+
+
+/* Seconds in tv */
+static double timeval_seconds(struct timeval tv) {
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+
+
+/* Seconds from start to end */
+static double elapsed_seconds(struct timespec start, struct timespec end) {
+    return (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+}
+
+
+
+/* Describe what became of a process: Running, Stopped, Done, Exit N, 
+ * or the name of the signal that killed it. */
+static void print_proc_state(process_t *proc, FILE *out) {
+    int status = proc->wait_status;
+    if (proc->status == PSTAT_RUNNING)
+        fprintf(out, "%-8s", "Running");
+    else if (proc->status == PSTAT_STOPPED)
+        fprintf(out, "%-8s", "Stopped");
+    else if (WIFSIGNALED(status))
+        fprintf(out, "SIG%-5s", sigabbrev_np(WTERMSIG(status)));
+    else if (WEXITSTATUS(status) != 0)
+        fprintf(out, "Exit %-3d", WEXITSTATUS(status));
+    else
+        fprintf(out, "%-8s", "Done");
+}
+
+
+
+/* Print one line of resource usage: user and system CPU seconds, peak 
+ * resident set size, and wall-clock seconds. A negative maxrss means the
+ * usage is not known yet. */
+static void print_usage(double user, double sys, long maxrss, double real,
+                        FILE *out) {
+    if (maxrss < 0)
+        fprintf(out, "%9s %9s %9s", "-", "-", "-");
+    else
+        fprintf(out, "%8.3fu %8.3fs %8ldK", user, sys, maxrss);
+    fprintf(out, " %9.3fr", real);
+}
+
+
+
+/**
+ * print_job_usage
+ * Prints the resources each process of job used, one line per process,
+ * followed by the job's total. Processes that are still alive show only
+ * their wall-clock time so far. The job's CPU time is the sum over its 
+ * processes, its RSS the largest of theirs, and its wall-clock time runs
+ * from the first spawn to the last exit (or to now).
+ */
+static void print_job_usage(struct job *job, FILE *out) {
+    if (job->num_procs == 0)    // QUEUED, or never got started
+        return;
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double user = 0, sys = 0;
+    long maxrss = 0;
+    struct timespec first = now, last = job->procs[0].started;
+    bool all_reaped = true;
+
+    for (int i = 0; i < job->num_procs; i++) {
+        process_t *proc = &job->procs[i];
+        bool reaped = proc->status == PSTAT_TERMINATED;
+        struct timespec end = reaped ? proc->ended : now;
+
+        fprintf(out, "\t%-7d ", proc->pid);
+        print_proc_state(proc, out);
+        print_usage(timeval_seconds(proc->usage.ru_utime),
+                    timeval_seconds(proc->usage.ru_stime),
+                    reaped ? proc->usage.ru_maxrss : -1,
+                    elapsed_seconds(proc->started, end), out);
+        for (char **p = proc->command->argv; *p; p++)
+            fprintf(out, "%s%s", p == proc->command->argv ? "  " : " ", *p);
+        fprintf(out, "\n");
+
+        user += timeval_seconds(proc->usage.ru_utime);
+        sys += timeval_seconds(proc->usage.ru_stime);
+        if (proc->usage.ru_maxrss > maxrss)
+            maxrss = proc->usage.ru_maxrss;
+        if (elapsed_seconds(proc->started, first) > 0)
+            first = proc->started;
+        if (elapsed_seconds(last, end) > 0)
+            last = end;
+        all_reaped &= reaped;
+    }
+
+    fprintf(out, "\t%-7s %-8s", "total", all_reaped ? "" : "(so far)");
+    print_usage(user, sys, maxrss, elapsed_seconds(first, last), out);
+    fprintf(out, "\n");
+}
+
+
+
+/**
+ * notify_job
+ * Queues a report about job. If status is NULL, the job line shows the 
+ * job's current status.
+ */
+static void notify_job(struct job *job, const char *status) {
+    char *msg;
+    size_t len;
+    FILE *out = open_memstream(&msg, &len);
+    if (out == NULL)
+        utils_fatal_error("cannot queue job notification: ");
+
+    if (status == NULL)
+        print_job(job, out);
+    else {
+        fprintf(out, "[%d]\t%s\t\t(", job->jid, status);
+        print_cmdline(job->pipe, out);
+        fprintf(out, ")\n");
+    }
+    fclose(out);
+    notify_queue_push(&notifications, msg);
+}
+
+
+
+/**
+ * flush_notifications
+ * Prints all queued job reports with a single write.
+ */
+static void flush_notifications(void) {
+    fflush(stdout);
+    notify_queue_flush(&notifications, STDOUT_FILENO);
 }
 
 
 
+/* sigchld_fd: signalfd through which SIGCHLD is received. SIGCHLD stays
+               blocked for the whole life of the shell; it is never 
+               delivered asynchronously. */
+static int sigchld_fd;
+
+
+
 /**
- * sigchld_handler
+ * reap_children
  * 
- * Suggested SIGCHLD handler.
- *
  * Call waitpid() to learn about any child processes that
  * have exited or changed status (been stopped, needed the
  * terminal, etc.)
  * Just record the information by updating the job list
- * data structures.  Since the call may be spurious (e.g.
- * an already pending SIGCHLD is delivered even though
- * a foreground process was already reaped), ignore when
- * waitpid returns -1.
+ * data structures.  Since the signal may be spurious (e.g.
+ * a SIGCHLD is pending even though the foreground process
+ * was already reaped), ignore when waitpid returns 0 or -1.
  * Use a loop with WNOHANG since only a single SIGCHLD 
- * signal may be delivered for multiple children that have 
+ * signal may be pending for multiple children that have 
  * exited. All of them need to be reaped.
  */
-static void sigchld_handler(int sig, siginfo_t *info, void *_ctxt) {
+static void reap_children(void) {
 
     pid_t child;
     int status;
+    struct rusage usage;
+
+    while ((child = wait4(-1, &status, WUNTRACED | WNOHANG, &usage)) > 0) {
+        handle_child_status(child, status, &usage);
+    }
+}
+
 
-    assert(sig == SIGCHLD);
 
-    while ((child = waitpid(-1, &status, WUNTRACED | WNOHANG)) > 0) {
-        handle_child_status(child, status);
+/**
+ * sigchld_ready
+ * Event loop handler for sigchld_fd.
+ */
+static void sigchld_ready(int fd, void *data) {
+    signal_drain_fd(fd);
+    reap_children();
+}
+
+
+
+/**
+ * poll_proc
+ * Collects a pending state change of a single process through its pidfd,
+ * without blocking. options is WEXITED and/or WSTOPPED.
+ * The waitid system call is invoked directly since glibc's wrapper does
+ * not pass on its rusage argument.
+ * Return Value: Non-zero (true) if a state change was handled.
+ */
+static bool poll_proc(process_t *proc, int options) {
+
+    siginfo_t info;
+    struct rusage usage;
+    info.si_pid = 0;
+    if (syscall(SYS_waitid, P_PIDFD, proc->pidfd, &info, 
+                options | WNOHANG, &usage) == -1
+        || info.si_pid == 0)
+        return false;
+
+    // Turn the siginfo back into a waitpid()-style status
+    int status;
+    switch (info.si_code) {
+    case CLD_EXITED:
+        status = W_EXITCODE(info.si_status, 0);
+        break;
+    case CLD_KILLED:
+        status = W_EXITCODE(0, info.si_status);
+        break;
+    case CLD_DUMPED:
+        status = W_EXITCODE(0, info.si_status) | WCOREFLAG;
+        break;
+    case CLD_STOPPED:
+        status = W_STOPCODE(info.si_status);
+        break;
+    default:
+        return false;
     }
+
+    handle_child_status(info.si_pid, status, &usage);
+    return true;
 }
 
 
@@ -327,77 +1113,120 @@ static void sigchld_handler(int sig, siginfo_t *info, void *_ctxt) {
  * The code below relies on `job->status` having been set to FOREGROUND
  * and `job->num_processes_alive` having been set to the number of
  * processes successfully forked for this job.
+ *
+ * Only this job's processes are waited for: we poll their pidfds, which
+ * become readable when they exit, and sigchld_fd, since a stop is only 
+ * announced through SIGCHLD. On a SIGCHLD, only this job's processes are
+ * checked for stops. Children of other jobs that change state meanwhile 
+ * are reaped once the foreground job is done, unless jobs are QUEUED and
+ * waiting for them.
  */
 static void wait_for_job(struct job *job) {
 
-    assert(signal_is_blocked(SIGCHLD));
-
     while (job->status == FOREGROUND && job->num_processes_alive > 0) {
-        int status;
-
-        pid_t child = waitpid(-1, &status, WUNTRACED);
-
-        // When called here, any error returned by waitpid indicates a logic
-        // bug in the shell.
-        // In particular, ECHILD "No child process" means that there has
-        // already been a successful waitpid() call that reaped the child, so
-        // there's likely a bug in handle_child_status where it failed to update
-        // the "job" status and/or num_processes_alive fields in the required
-        // fashion.
-        // Since SIGCHLD is blocked, there cannot be races where a child's exit
-        // was handled via the SIGCHLD signal handler.
-        if (child != -1)
-            handle_child_status(child, status);
-        else
-            utils_fatal_error("waitpid failed, see code for explanation");
-    }
-}
 
+        // Sized anew each time: a parallel job gains processes as it runs
+        int noutputs = list_size(&pending_outputs);
+        struct pollfd fds[job->num_processes_alive + 1 + num_timers 
+                          + noutputs];
+        process_t *polled[job->num_processes_alive];
+        struct job *timed[num_timers + 1];     // never of length 0
+        struct builtin_output *writing[noutputs + 1];
+
+        int nfds = 0;
+        for (int i = 0; i < job->num_procs; i++) {
+            if (job->procs[i].status != PSTAT_TERMINATED) {
+                polled[nfds] = &job->procs[i];
+                fds[nfds].fd = job->procs[i].pidfd;
+                fds[nfds].events = POLLIN;
+                nfds++;
+            }
+        }
+        fds[nfds].fd = sigchld_fd;
+        fds[nfds].events = POLLIN;
+
+        // Any job's timeout may run out while we wait
+        int ntimers = 0;
+        for (struct list_elem *e = list_begin(&job_list);
+             e != list_end(&job_list) && ntimers < num_timers;
+             e = list_next(e)) {
+
+            struct job *other = list_entry(e, struct job, elem);
+            if (other->timer_fd != -1) {
+                timed[ntimers] = other;
+                fds[nfds + 1 + ntimers].fd = other->timer_fd;
+                fds[nfds + 1 + ntimers].events = POLLIN;
+                ntimers++;
+            }
+        }
 
+        // The job may be reading builtin output that is still pending
+        struct pollfd *out_fds = &fds[nfds + 1 + ntimers];
+        int i = 0;
+        for (struct list_elem *e = list_begin(&pending_outputs);
+             e != list_end(&pending_outputs);
+             e = list_next(e), i++) {
 
-/**
- * all_procs_stopped
- * Helper method for handle_stopped_child
- * Return Value: Non-zero (true) if all processes in job->procs are stopped, 
- *               zero (false) otherwise (there is an actively running process). 
- */
-static char all_procs_stopped(struct job *job) {
-    for (int i = 0; i < job->num_processes_alive; i++) {
-        if (job->procs[i].status == PSTAT_RUNNING) {
-            // There is a running process, return false
-            return 0;
+            writing[i] = list_entry(e, struct builtin_output, elem);
+            out_fds[i].fd = writing[i]->fd;
+            out_fds[i].events = POLLOUT;
+        }
+
+        if (poll(fds, nfds + 1 + ntimers + noutputs, -1) == -1) {
+            if (errno == EINTR)
+                continue;
+            utils_fatal_error("poll failed in wait_for_job: ");
+        }
+
+        for (int i = 0; i < noutputs; i++) {
+            if (out_fds[i].revents)
+                builtin_output_ready(writing[i]->fd, writing[i]);
+        }
+
+        for (int i = 0; i < ntimers; i++) {
+            if (fds[nfds + 1 + i].revents)
+                job_timer_expired(timed[i]);
+        }
+
+        for (int i = 0; i < nfds; i++) {
+            if (fds[i].revents)
+                poll_proc(polled[i], WEXITED);
+        }
+
+        if (fds[nfds].revents) {
+            signal_drain_fd(sigchld_fd);
+            // Queued jobs and parallel batches are waiting for other 
+            // children to exit, so reap everyone now rather than once 
+            // this job is done
+            if (!list_empty(&job_queue) || num_batches > 0)
+                reap_children();
+            for (int i = 0; i < nfds && job->status == FOREGROUND; i++) {
+                if (polled[i]->status != PSTAT_TERMINATED)
+                    poll_proc(polled[i], WSTOPPED);
+            }
         }
     }
-    return 1;
+
+    // The SIGCHLDs of other children were consumed above
+    reap_children();
 }
 
 
 
 /**
- * find_pid
- * Searches through all processes in all jobs to find the process with the 
- * given pid. Returns the job this process belongs to and sets the 
- * process_t * at out_proc to point to the process_t struct.
+ * all_procs_stopped
+ * Helper method for handle_stopped_child
+ * Return Value: Non-zero (true) if all processes in job->procs are stopped, 
+ *               zero (false) otherwise (there is an actively running process). 
  */
-static struct job *find_pid(pid_t pid, process_t **out_proc) {
-
-    // foreach job
-    for (struct list_elem *job_l_elem = list_begin(&job_list);
-                 job_l_elem != list_end(&job_list);
-                 job_l_elem = list_next(job_l_elem)) {
-        
-        struct job *job = list_entry(job_l_elem, struct job, elem);
-        for (int i = 0; i < job->num_processes_alive; i++) {
-            if (job->procs[i].pid == pid) { // Found it
-                *out_proc = &job->procs[i];
-                return job;
-            }
+static char all_procs_stopped(struct job *job) {
+    for (int i = 0; i < job->num_procs; i++) {
+        if (job->procs[i].status == PSTAT_RUNNING) {
+            // There is a running process, return false
+            return 0;
         }
     }
-
-    // Nothing was found
-    *out_proc = NULL;
-    return NULL;
+    return 1;
 }
 
 
@@ -414,8 +1243,9 @@ static void handle_stopped_child(pid_t pid,
     if (WSTOPSIG(status) == SIGTTOU || WSTOPSIG(status) == SIGTTIN) {
         
         if (job->status == FOREGROUND) {
-            termstate_give_terminal_to(&job->saved_tty_state, job->pgid);
-            kill(-1 * job->pgid, SIGCONT);
+            if (interactive)
+                termstate_give_terminal_to(&job->saved_tty_state, job->pgid);
+            signal_job(job, SIGCONT);
             return;
         }
     }
@@ -431,8 +1261,9 @@ static void handle_stopped_child(pid_t pid,
             job->status = NEEDSTERMINAL;
         else
             job->status = STOPPED;
-        termstate_save(&job->saved_tty_state);
-        print_job(job);
+        if (interactive)
+            termstate_save(&job->saved_tty_state);
+        notify_job(job, NULL);
     }
 }
 
@@ -443,38 +1274,54 @@ static void handle_stopped_child(pid_t pid,
  */
 static void handle_terminated_child(pid_t pid, 
                                     int status, 
+                                    const struct rusage *usage,
                                     struct job *job, 
                                     process_t *proc) {
 
-    // If child was terminated by a signal: print a representative message
-    if (WIFSIGNALED(status)) {
-        int sig = WTERMSIG(status);
-        printf("%s\n", strsignal(sig));
-        fflush(stdout);
-    }
+    // Record what the process cost
+    clock_gettime(CLOCK_MONOTONIC, &proc->ended);
+    proc->wait_status = status;
+    proc->usage = *usage;
+
+    // If child was terminated by a signal: remember it for the report
+    if (WIFSIGNALED(status))
+        job->term_signal = WTERMSIG(status);
 
-    // Decrement job->num_processes_alive and remove the proc
-    // from job's procs array.
-    int procs_i = proc - job->procs;
-    memmove(proc,
-            proc + 1,
-            sizeof(process_t) * (job->num_processes_alive - procs_i - 1));
+    // Decrement job->num_processes_alive, retire the proc's slot
+    // and remove it from the pid index.
+    pid_table_remove(&pid2proc, pid);
+    close(proc->pidfd);
+    proc->status = PSTAT_TERMINATED;
     job->num_processes_alive--;
 
+    // A parallel job replaces the process with the next item, if any
+    if (job->batch)
+        parallel_reap(job, proc, status);
+
     // If num_processes_alive == 0, update job status
     if (job->num_processes_alive == 0) {
 
-        // If foreground job, save the shell's new good termstate
+        // If foreground job, save the shell's new good termstate. A killed
+        // foreground job is reported by the signal's name alone.
         if (job->status == FOREGROUND) {
-            if (WIFEXITED(status) && WEXITSTATUS(status) == 0)
+            if (interactive && WIFEXITED(status) && WEXITSTATUS(status) == 0)
                 termstate_sample();
+            if (job->term_signal || job->timed_out) {
+                char *msg;
+                if (asprintf(&msg, "%s\n", job->timed_out ? "Timed out" 
+                                           : strsignal(job->term_signal)) < 0)
+                    utils_fatal_error("cannot queue job notification: ");
+                notify_queue_push(&notifications, msg);
+            }
             job->status = TERMINATED;
         }
 
         // If num_processes_alive == 0 and this isn't the fg job, 
-        // remove the job from data structures
+        // report it and remove the job from data structures
         else {
-            free(job->procs);
+            notify_job(job, job->timed_out ? "Timed out"
+                            : job->term_signal ? strsignal(job->term_signal) 
+                            : "Done");
             list_remove(&job->elem);
             delete_job(job);
         }
@@ -487,12 +1334,12 @@ static void handle_terminated_child(pid_t pid,
 /**
  * handle_child_status
  * 
- * This is the big method we need to implement. It will be called both when a 
- * SIGCHLD is received and by wait_for_job when waiting for a foreground job.
+ * This is the big method we need to implement. It is called from the event 
+ * loop whenever sigchld_fd reports a SIGCHLD, both at the prompt and while
+ * wait_for_job is waiting for a foreground job.
  */
-static void handle_child_status(pid_t pid, int status) {
-
-    assert(signal_is_blocked(SIGCHLD));
+static void handle_child_status(pid_t pid, int status, 
+                                const struct rusage *usage) {
 
     /* To be implemented. 
      * Step 1. Given the pid, determine which job this pid is a part of
@@ -505,13 +1352,13 @@ static void handle_child_status(pid_t pid, int status) {
      */
 
     // Find the struct job and process_t for pid
-    process_t *proc;
-    struct job *job = find_pid(pid, &proc);
-    if (job == NULL) { // This should (hopefully) never happen
+    process_t *proc = pid_table_lookup(&pid2proc, pid);
+    if (proc == NULL) { // This should (hopefully) never happen
         fprintf(stderr, "Received child status for unrecognized pid %d\n", pid);
         fflush(stderr);
         exit(1);
     }
+    struct job *job = proc->job;
 
     // If stopped, call handle_stopped_child
     if (WIFSTOPPED(status)) {
@@ -520,7 +1367,7 @@ static void handle_child_status(pid_t pid, int status) {
 
     // If terminated, call handle_terminated_child
     else if (WIFEXITED(status) || WIFSIGNALED(status)) {
-        handle_terminated_child(pid, status, job, proc);
+        handle_terminated_child(pid, status, usage, job, proc);
     }
 
 }
@@ -533,6 +1380,21 @@ static void handle_child_status(pid_t pid, int status) {
 
 
 
+/**
+ * make_pipe
+ * Creates a close-on-exec pipe with a capacity of pipe_size bytes.
+ * Return Value: 0 on success, -1 on error.
+ */
+static int make_pipe(int pipe[]) {
+    if (pipe2(pipe, O_CLOEXEC) < 0)
+        return -1;
+    if (pipe_size > 0)
+        fcntl(pipe[PIPE_WRITE], F_SETPIPE_SZ, pipe_size);
+    return 0;
+}
+
+
+
 /**
  * close_pipe
  * Little helper method for closing pipes
@@ -549,23 +1411,32 @@ static void close_pipe(int pipe[]) {
 
 
 /**
- * exit_builtin
- * Called by main when user types "exit". Sends SIGKILL to all job pgroups and 
- * reaps them (this can be done by putting them in fg and calling 
- * wait_for_job), then exits.
+ * exit_shell
+ * Sends SIGKILL to all job pgroups and reaps them (this can be done by 
+ * putting them in fg and calling wait_for_job), then exits.
  */
-static void exit_builtin(int in_fd, int out_fd) {
-
-    // Kill all jobs
-    for (struct list_elem *jobs_l_elem = list_begin(&job_list);
-         jobs_l_elem != list_end(&job_list);
-         jobs_l_elem = list_next(jobs_l_elem)) {
+static void exit_shell(void) {
+
+    // Queued jobs never ran, and none may start while the others are
+    // killed and their slots are freed
+    exiting = true;
+    while (!list_empty(&job_queue)) {
+        struct job *job = list_entry(list_front(&job_queue), 
+                                     struct job, queue_elem);
+        list_remove(&job->elem);
+        delete_job(job);
+    }
 
-        struct job *job = list_entry(jobs_l_elem, struct job, elem);
+    // Kill all jobs. Background jobs that end meanwhile are deleted by
+    // reap_children, so always take the first one left.
+    while (!list_empty(&job_list)) {
+        struct job *job = list_entry(list_front(&job_list), struct job, elem);
         
         job->status = FOREGROUND;
-        kill(-1 * job->pgid, SIGKILL);
+        signal_job(job, SIGKILL);
         wait_for_job(job);
+        list_remove(&job->elem);
+        delete_job(job);
     }
 
     // Exit
@@ -574,19 +1445,98 @@ static void exit_builtin(int in_fd, int out_fd) {
 
 
 
+/**
+ * exit_builtin
+ * Called when user types "exit".
+ */
+static int exit_builtin(char **argv, FILE *out) {
+    exit_shell();
+    return 0;
+}
+
+
+
 /**
  * jobs_builtin
  * Called by shell loop when user types "jobs". Prints a list showing status
  * and args info for each active job.
  */
-static void jobs_builtin(int in_fd, int out_fd) {
+static int jobs_builtin(char **argv, FILE *out) {
+    if (argv[1] != NULL && !strcmp(argv[1], "--timeout")) {
+        if (argv[2] == NULL || argv[3] == NULL) {
+            fprintf(out, "usage: jobs --timeout %%n SECS\n");
+            return 1;
+        }
+        const char *jidstr = argv[2][0] == '%' ? argv[2] + 1 : argv[2];
+        struct job *job = get_job_from_jid(atoi(jidstr));
+        if (job == NULL) {
+            fprintf(out, "%s %s: No such job\n", argv[0], argv[2]);
+            return 1;
+        }
+        double timeout;
+        if (!parse_duration(argv[3], &timeout)) {
+            fprintf(out, "%s: %s: invalid time interval\n", argv[0], argv[3]);
+            return 1;
+        }
+        // Counted from now; 0 removes the limit. A queued job's clock
+        // starts when it does.
+        job->timeout = timeout;
+        job->timed_out = false;
+        if (job->status != QUEUED)
+            arm_timeout(job);
+        return 0;
+    }
+
+    bool long_format = argv[1] != NULL && !strcmp(argv[1], "-l");
     for (struct list_elem *jobs_l_elem = list_begin(&job_list);
          jobs_l_elem != list_end(&job_list);
          jobs_l_elem = list_next(jobs_l_elem)) {
 
         struct job *job = list_entry(jobs_l_elem, struct job, elem);
-        print_job(job);
+        print_job(job, out);
+        if (long_format)
+            print_job_usage(job, out);
+    }
+    return 0;
+}
+
+
+
+/* Print tv as minutes and seconds, the way times does */
+static void print_minutes(struct timeval tv, FILE *out) {
+    fprintf(out, "%ldm%.3fs", (long) tv.tv_sec / 60, 
+            tv.tv_sec % 60 + tv.tv_usec / 1e6);
+}
+
+
+
+/**
+ * times_builtin
+ * Prints the user and system time used by the shell and by all of its 
+ * children so far, followed by the resource usage of the last job that
+ * finished.
+ */
+static int times_builtin(char **argv, FILE *out) {
+    struct rusage self, children;
+    getrusage(RUSAGE_SELF, &self);
+    getrusage(RUSAGE_CHILDREN, &children);
+
+    print_minutes(self.ru_utime, out);
+    fputc(' ', out);
+    print_minutes(self.ru_stime, out);
+    fputc('\n', out);
+    print_minutes(children.ru_utime, out);
+    fputc(' ', out);
+    print_minutes(children.ru_stime, out);
+    fputc('\n', out);
+
+    if (last_job) {
+        fprintf(out, "last job: (");
+        print_cmdline(last_job->pipe, out);
+        fprintf(out, ")\n");
+        print_job_usage(last_job, out);
     }
+    return 0;
 }
 
 
@@ -595,26 +1545,29 @@ static void jobs_builtin(int in_fd, int out_fd) {
  * kill_builtin
  * Sends SIGKILL to all processes in the job with the given jid.
  */
-static void kill_builtin(char **argv) {
+static int kill_builtin(char **argv, FILE *out) {
     
     int jid = atoi(argv[1]);
     if (jid < 1) {
-        printf("%s %s: No such job\n", argv[0], argv[1]);
-        fflush(stdout);
+        fprintf(out, "%s %s: No such job\n", argv[0], argv[1]);
     }
     struct job *job = get_job_from_jid(jid);
-    if (job) {
+    if (job && job->status == QUEUED) {
+        list_remove(&job->elem);
+        delete_job(job);
+    }
+    else if (job) {
         job->status = FOREGROUND;
-        kill(-1 * job->pgid, SIGKILL);
+        signal_job(job, SIGKILL);
         wait_for_job(job);
-        free(job->procs);
         list_remove(&job->elem);
         delete_job(job);
     }
     else {
-        printf("%s %s: No such job\n", argv[0], argv[1]);
-        fflush(stdout);
+        fprintf(out, "%s %s: No such job\n", argv[0], argv[1]);
+        return 1;
     }
+    return 0;
 }
 
 
@@ -624,23 +1577,30 @@ static void kill_builtin(char **argv) {
  * Sends a SIGCONT to all processes in the given job and sets its status
  * to BACKGROUND.
  */
-static void bg_builtin(char **argv) {
+static int bg_builtin(char **argv, FILE *out) {
     int jid = atoi(argv[1]);
     if (jid < 1) {
-        printf("%s %s: No such job\n", argv[0], argv[1]);
-        fflush(stdout);
+        fprintf(out, "%s %s: No such job\n", argv[0], argv[1]);
     }
     struct job *job = get_job_from_jid(jid);
-    if (job) {
+    if (job && job->status == QUEUED) {
+        // Start it right away, even if that exceeds jobs_max
+        if (!start_job(job, true))
+            return 1;
+        fprintf(out, "[%d] %d\n", jid, job->pgid);
+    }
+    else if (job) {
         job->status = BACKGROUND;
-        kill(-1 * job->pgid, SIGCONT);
-        printf("[%d] %d\n", jid, job->pgid);
-        fflush(stdout);
+        signal_job(job, SIGCONT);
+        if (job->batch)
+            parallel_refill(job);
+        fprintf(out, "[%d] %d\n", jid, job->pgid);
     }
     else {
-        printf("%s %s: No such job\n", argv[0], argv[1]);
-        fflush(stdout);
+        fprintf(out, "%s %s: No such job\n", argv[0], argv[1]);
+        return 1;
     }
+    return 0;
 }
 
 
@@ -650,32 +1610,37 @@ static void bg_builtin(char **argv) {
  * Sends a SIGCONT to all processes in the given job, sets its status to 
  * FOREGROUND, gives it terminal ownership, and waits for its completion.
  */
-static void fg_builtin(char **argv) {
+static int fg_builtin(char **argv, FILE *out) {
 
     int jid = atoi(argv[1]);
     if (jid < 1) {
-        printf("%s %s: No such job\n", argv[0], argv[1]);
-        fflush(stdout);
+        fprintf(out, "%s %s: No such job\n", argv[0], argv[1]);
     }
     struct job *job = get_job_from_jid(jid);
+    if (job && job->status == QUEUED && !start_job(job, false))
+        return 1;
     if (job) {
         job->status = FOREGROUND;
-        termstate_give_terminal_to(&job->saved_tty_state, job->pgid);
-        kill(-1 * job->pgid, SIGCONT);
-        print_cmdline(job->pipe);
+        if (interactive)
+            termstate_give_terminal_to(&job->saved_tty_state, job->pgid);
+        signal_job(job, SIGCONT);
+        if (job->batch)
+            parallel_refill(job);
+        // Echo the command line before the job takes over the terminal
+        print_cmdline(job->pipe, stdout);
         printf("\n");
         fflush(stdout);
         wait_for_job(job);
         if (job->status == TERMINATED) {
-            free(job->procs);
             list_remove(&job->elem);
             delete_job(job);
         }
     }
     else {
-        printf("%s %s: No such job\n", argv[0], argv[1]);
-        fflush(stdout);
+        fprintf(out, "%s %s: No such job\n", argv[0], argv[1]);
+        return 1;
     }
+    return 0;
 }
 
 
@@ -683,36 +1648,37 @@ static void fg_builtin(char **argv) {
 /**
  * stop_builtin
  */
-static void stop_builtin(char **argv) {
+static int stop_builtin(char **argv, FILE *out) {
     int jid = atoi(argv[1]);
     if (jid < 1) {
-        printf("%s %s: No such job\n", argv[0], argv[1]);
-        fflush(stdout);
+        fprintf(out, "%s %s: No such job\n", argv[0], argv[1]);
     }
     struct job *job = get_job_from_jid(jid);
     if (job) {
-        kill(-1 * job->pgid, SIGSTOP);
+        signal_job(job, SIGSTOP);
     }
     else {
-        printf("%s %s: No such job\n", argv[0], argv[1]);
-        fflush(stdout);
+        fprintf(out, "%s %s: No such job\n", argv[0], argv[1]);
+        return 1;
     }
+    return 0;
 }
 
 /**
  * history_builtin
  */
-static void history_builtin(char **argv) {
+static int history_builtin(char **argv, FILE *out) {
     HISTORY_STATE *curhist = history_get_history_state();
     for (int i = 1; i <= curhist->length; i++) {
-        printf("%d %s\n", i, curhist->entries[i-1]->line);
+        fprintf(out, "%d %s\n", i, curhist->entries[i-1]->line);
     }
+    return 0;
 }
 
 /**
  * cd_builtin
  */
-static void cd_builtin(char **argv) {
+static int cd_builtin(char **argv, FILE *out) {
     // If no path is specified, go to the home directory
     if (argv[1] == NULL || strcmp(argv[1], "") == 0) {
         argv[1] = getenv("HOME");  // Use the HOME environment variable
@@ -721,7 +1687,175 @@ static void cd_builtin(char **argv) {
     // Attempt to change directory
     if (chdir(argv[1]) != 0) {
         perror("cd");  // If chdir fails, print an error message
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * hash_builtin
+ * With no arguments, lists the remembered command locations. "hash -r"
+ * forgets them all; "hash name..." looks up and remembers each name.
+ * "hash -s" reports how well the parse cache is doing.
+ */
+static int hash_builtin(char **argv, FILE *out) {
+    int status = 0;
+    if (argv[1] == NULL) {
+        if (cmd_hash_table.count == 0)
+            fprintf(out, "hash: hash table empty\n");
+        else {
+            fprintf(out, "hits\tcommand\n");
+            cmd_table_print(&cmd_hash_table, out);
+        }
+    }
+    else if (strcmp(argv[1], "-r") == 0) {
+        cmd_table_clear(&cmd_hash_table);
+    }
+    else if (strcmp(argv[1], "-s") == 0) {
+        parse_cache_print(&parse_cache, out);
+    }
+    else {
+        for (int i = 1; argv[i] != NULL; i++) {
+            if (cmd_table_resolve(&cmd_hash_table, argv[i]) == NULL) {
+                fprintf(out, "hash: %s: not found\n", argv[i]);
+                status = 1;
+            }
+        }
+    }
+    return status;
+}
+
+/**
+ * set_builtin
+ * With no arguments, lists the shell's options. "set name=value..." 
+ * changes them. Options:
+ *   pipesize   capacity of the pipes between pipeline stages, e.g. 1M;
+ *              0 restores the kernel default
+ *   jobs_max   number of background jobs that may run at once; 0 means
+ *              no limit
+ */
+static int set_builtin(char **argv, FILE *out) {
+    if (argv[1] == NULL) {
+        fprintf(out, "pipesize=%d\n", pipe_size);
+        fprintf(out, "jobs_max=%d\n", jobs_max);
+        return 0;
+    }
+
+    int status = 0;
+
+    for (int i = 1; argv[i] != NULL; i++) {
+        char *value = strchr(argv[i], '=');
+        if (value == NULL) {
+            fprintf(out, "set: %s: expected name=value\n", argv[i]);
+            status = 1;
+            continue;
+        }
+        // argv may be shared with the parse cache, so leave it intact
+        int namelen = value++ - argv[i];
+
+        if (namelen == strlen("pipesize") 
+            && strncmp(argv[i], "pipesize", namelen) == 0) {
+            long size;
+            if (utils_parse_size(value, &size) < 0 || size > INT_MAX) {
+                fprintf(out, "set: pipesize: invalid size %s\n", value);
+                status = 1;
+                continue;
+            }
+
+            // Try the size on a scratch pipe, and remember what the 
+            // kernel actually grants (it rounds up to a power of two pages)
+            int probe[2];
+            if (size > 0 && pipe2(probe, O_CLOEXEC) == 0) {
+                int granted = fcntl(probe[PIPE_WRITE], F_SETPIPE_SZ, size);
+                if (granted < 0) {
+                    fprintf(out, "set: pipesize: %s\n", strerror(errno));
+                    status = 1;
+                }
+                else
+                    pipe_size = granted;
+                close_pipe(probe);
+            }
+            else if (size == 0) {
+                pipe_size = 0;
+            }
+        }
+        else if (namelen == strlen("jobs_max")
+                 && strncmp(argv[i], "jobs_max", namelen) == 0) {
+            char *end;
+            long max = strtol(value, &end, 10);
+            if (*value == '\0' || *end != '\0' || max < 0 || max > INT_MAX) {
+                fprintf(out, "set: jobs_max: invalid number %s\n", value);
+                status = 1;
+                continue;
+            }
+            jobs_max = max;
+            start_queued_jobs();
+        }
+        else {
+            fprintf(out, "set: %.*s: unknown option\n", namelen, argv[i]);
+            status = 1;
+        }
     }
+    return status;
+}
+
+/**
+ * parallel_builtin
+ * "parallel" runs as a job of its own (see run_parallel); this is only
+ * reached when it is used as a stage of a longer pipeline.
+ */
+static int parallel_builtin(char **argv, FILE *out) {
+    fprintf(out, "%s: cannot be part of a pipeline\n", argv[0]);
+    return 1;
+}
+
+/* builtins: Every command the shell runs itself. A new builtin only needs
+             an entry here. */
+static const struct builtin builtins[] = {
+    { "exit", exit_builtin },
+    { "jobs", jobs_builtin },
+    { "kill", kill_builtin },
+    { "bg", bg_builtin },
+    { "fg", fg_builtin },
+    { "stop", stop_builtin },
+    { "history", history_builtin },
+    { "cd", cd_builtin },
+    { "hash", hash_builtin },
+    { "set", set_builtin },
+    { "times", times_builtin },
+    { "parallel", parallel_builtin },
+};
+
+/**
+ * spawn_command
+ * Spawns command, using the path remembered in cmd_hash_table if there is
+ * one. If exec'ing that path fails, the child itself falls back to a PATH
+ * search, and the stale entry is dropped. Other failures, such as a file
+ * action or a spawn attribute the system refuses, keep the entry.
+ * Return Value: 0 on success, an errno value otherwise.
+ */
+static int spawn_command(pid_t *pid, int *pidfd,
+                         struct ast_command *command,
+                         posix_spawn_file_actions_t *file_actions,
+                         posix_spawnattr_t *spawnattr,
+                         char *envp[]) {
+
+    // A pipeline of one stage, which reports a stale path in path_err
+    struct posix_spawn_stage stage = {
+        .file = command->argv[0],
+        .path = cmd_table_resolve(&cmd_hash_table, command->argv[0]),
+        .argv = command->argv,
+        .file_actions = file_actions,
+    };
+    posix_spawn_pipeline_np(&stage, 1, spawnattr, envp);
+    if (stage.path_err != 0)
+        cmd_table_forget(&cmd_hash_table, command->argv[0]);
+    if (stage.err != 0)
+        return stage.err;
+
+    *pid = stage.pid;
+    *pidfd = stage.pidfd;
+    return 0;
 }
 
 /**
@@ -771,19 +1905,8 @@ static posix_spawn_file_actions_t setup_file_actions(struct ast_pipeline *pipeli
                                          STDOUT_FILENO);
     }
 
-    // close the extra pipe fds
-    if (prev_pipe[PIPE_READ] > 2) {
-        posix_spawn_file_actions_addclose(&file_actions, prev_pipe[PIPE_READ]);
-    }
-    if (prev_pipe[PIPE_WRITE] > 2) {
-        posix_spawn_file_actions_addclose(&file_actions, prev_pipe[PIPE_WRITE]);
-    }
-    if (new_pipe[PIPE_READ] > 2) {
-        posix_spawn_file_actions_addclose(&file_actions, new_pipe[PIPE_READ]);
-    }
-    if (new_pipe[PIPE_WRITE] > 2) {
-        posix_spawn_file_actions_addclose(&file_actions, new_pipe[PIPE_WRITE]);
-    }
+    // No need to close the pipe fds themselves: like every fd the shell
+    // creates, they are close-on-exec (dup2 clears the flag on the copy).
 
     // dup2 stderr to stdout if necessary
     if (command->dup_stderr_to_stdout) {
@@ -800,22 +1923,51 @@ static posix_spawn_file_actions_t setup_file_actions(struct ast_pipeline *pipeli
 /**
  * setup_spawnattr
  * Creates and initializes a posix_spawnattr_t struct to be used in the 
- * creation of the processes that will run commands from pipeline.
+ * creation of processes that join process group pgrp (0 for a new one).
+ * Foreground processes are given the terminal. The nice value, scheduling
+ * policy and CPU affinity in opts are applied in the child, which refers
+ * to opts->cpus until it has been spawned.
  * Note: posix_spawnattr_destroy needs to be called on the returned 
  *       struct after it's been used.
  */
-static posix_spawnattr_t setup_spawnattr(struct ast_pipeline *pipeline,
-                                         pid_t pgrp) {
+static posix_spawnattr_t setup_spawnattr(pid_t pgrp, bool foreground,
+                                         const struct spawn_options *opts) {
     
     posix_spawnattr_t spawnattr;
     posix_spawnattr_init(&spawnattr);
 
-    // Set pgroup
-    posix_spawnattr_setflags(&spawnattr, POSIX_SPAWN_SETPGROUP);
+    // Set pgroup (only with job control), and start the child with an 
+    // empty signal mask: the shell itself keeps SIGCHLD blocked at all times.
+    sigset_t empty_mask;
+    sigemptyset(&empty_mask);
+    short flags = (interactive ? POSIX_SPAWN_SETPGROUP : 0) | 
+                  POSIX_SPAWN_SETSIGMASK;
     posix_spawnattr_setpgroup(&spawnattr, pgrp);
+    posix_spawnattr_setsigmask(&spawnattr, &empty_mask);
+    posix_spawnattr_setpipesize_np(&spawnattr, pipe_size);
+
+    // Scheduling. Real-time policies get their lowest priority.
+    if (opts->set_nice) {
+        flags |= POSIX_SPAWN_SETNICE_NP;
+        posix_spawnattr_setnice_np(&spawnattr, opts->nice);
+    }
+    if (opts->policy != -1) {
+        struct sched_param param = {
+            .sched_priority = sched_get_priority_min(opts->policy)
+        };
+        flags |= POSIX_SPAWN_SETSCHEDULER;
+        posix_spawnattr_setschedpolicy(&spawnattr, opts->policy);
+        posix_spawnattr_setschedparam(&spawnattr, &param);
+    }
+    if (opts->set_affinity) {
+        flags |= POSIX_SPAWN_SETAFFINITY_NP;
+        posix_spawnattr_setaffinity_np(&spawnattr, sizeof opts->cpus, 
+                                       &opts->cpus);
+    }
+    posix_spawnattr_setflags(&spawnattr, flags);
 
     // Set controlling terminal
-    if (!pipeline->bg_job) {
+    if (interactive && foreground) {
         posix_spawnattr_tcsetpgrp_np(&spawnattr, termstate_get_tty_fd());
     }
 
@@ -824,272 +1976,1198 @@ static posix_spawnattr_t setup_spawnattr(struct ast_pipeline *pipeline,
 
 
 
-// DELETE LATER AND MAKE STATIC AGAIN IN termstate_management.c
-//extern int shell_pgrp;
-
-
 /**
- * shell_loop
- * Called by main to run the shell's read/eval loop. This is where all the 
- * job creation magic happens.
+ * add_process
+ * Records a newly spawned process of pipeline in *job, creating the job
+ * (with process group pgrp) if this is its first process.
  */
-static void shell_loop(char *envp[]) {
+static void add_process(struct job **job, struct ast_pipeline *pipeline,
+                        struct ast_command *command, pid_t pgrp,
+                        pid_t pid, int pidfd) {
+
+    // Create job struct if necessary, and set it up once its first
+    // process exists
+    if (*job == NULL)
+        *job = add_job(pipeline);
+    if ((*job)->procs == NULL) {
+        (*job)->pgid = pgrp;
+        (*job)->procs = malloc(sizeof(process_t) * 
+                               list_size(&pipeline->commands));
+        (*job)->num_procs = 0;
+        (*job)->status = pipeline->bg_job ? BACKGROUND : FOREGROUND;
+        if (interactive)
+            termstate_save(&(*job)->saved_tty_state);
+    }
 
-    int rc;
+    // Add process to the job struct
+    process_t *proc = &(*job)->procs[(*job)->num_procs++];
+    proc->pid = pid;
+    proc->pidfd = pidfd;
+    proc->job = *job;
+    proc->status = PSTAT_RUNNING;
+    proc->command = command;
+    clock_gettime(CLOCK_MONOTONIC, &proc->started);
+    memset(&proc->usage, 0, sizeof proc->usage);
+    (*job)->num_processes_alive++;
+    pid_table_insert(&pid2proc, pid, proc);
+}
 
-    for (;;) {
 
-        /* If you fail this assertion, you were about to enter readline()
-         * while SIGCHLD is blocked.  This means that your shell would be
-         * unable to receive SIGCHLD signals, and thus would be unable to
-         * wait for background jobs that may finish while the
-         * shell is sitting at the prompt waiting for user input.
-         */
-        assert(!signal_is_blocked(SIGCHLD));
 
-        /* If you fail this assertion, you were about to call readline()
-         * without having terminal ownership.
-         * This would lead to the suspension of your shell with SIGTTOU.
-         * Make sure that you call termstate_give_terminal_back_to_shell()
-         * before returning here on all paths.
-         */
-        assert(termstate_get_current_terminal_owner() == getpgrp());
+/**
+ * report_spawn_error
+ * Tells the user that command could not be spawned. Any error other than
+ * a missing program, or a nice value, scheduling policy or CPU set that
+ * the system refused, is fatal.
+ */
+static void report_spawn_error(struct ast_command *command, int rc) {
+    if (rc == ENOENT || rc == EPERM || rc == EACCES || rc == EINVAL) {
+        printf("%s: %s\n", command->argv[0], strerror(rc));
+        fflush(stdout);
+    }
+    else {
+        fprintf(stderr, "posix_spawnp error: %d\n", rc);
+        fflush(stderr);
+        exit_shell();
+    }
+}
 
-        /* Do not output a prompt unless shell's stdin is a terminal */
-        char *prompt = isatty(0) ? build_prompt() : NULL;
-        char *cmdline = readline(prompt);
-        free (prompt);
 
-        if (cmdline == NULL)  /* User typed EOF */
-            break;
 
-        char *expanded = NULL;
-    
-        int result = history_expand(cmdline, &expanded);
+/**
+ * pipeline_has_builtin
+ * Returns true if any command in pipeline is run by the shell itself.
+ */
+static bool pipeline_has_builtin(struct ast_pipeline *pipeline) {
+    for (struct list_elem *e = list_begin(&pipeline->commands);
+         e != list_end(&pipeline->commands);
+         e = list_next(e)) {
+
+        struct ast_command *command = list_entry(e, struct ast_command, elem);
+        if (builtin_table_lookup(&builtin_table, command->argv[0]))
+            return true;
+    }
+    return false;
+}
 
-        // Check if history expansion happened
-        if (result >= 0) {
-            free(cmdline);
-            cmdline = expanded;
-        } else {
-            printf("Error in history expansion\n");
-        }
-        
-        //Make sure to add history of commands
-        add_history(cmdline);
 
-        // Always free the expanded string
-        //free(expanded);
-        
-        struct ast_command_line *cline = ast_parse_command_line(cmdline);
-        free (cmdline);
-        if (cline == NULL)                  /* Error in command line */
-            continue;
 
-        if (list_empty(&cline->pipes)) {    /* User hit enter */
-            ast_command_line_free(cline);
-            continue;
-        }
+/**
+ * pipeline_has_external
+ * Returns true if any command of the pipeline is not a builtin, i.e. 
+ * running it spawns a process.
+ */
+static bool pipeline_has_external(struct ast_pipeline *pipeline) {
+    for (struct list_elem *e = list_begin(&pipeline->commands);
+         e != list_end(&pipeline->commands);
+         e = list_next(e)) {
+
+        struct ast_command *command = list_entry(e, struct ast_command, elem);
+        if (!builtin_table_lookup(&builtin_table, command->argv[0]))
+            return true;
+    }
+    return false;
+}
 
-        //ast_command_line_print(cline);      /* Output a representation of
-        //                                       the entered command line */
 
-        /* Free the command line.
-         * This will free the ast_pipeline objects still contained
-         * in the ast_command_line.  Once you implement a job list
-         * that may take ownership of ast_pipeline objects that are
-         * associated with jobs you will need to reconsider how you
-         * manage the lifetime of the associated ast_pipelines.
-         * Otherwise, freeing here will cause use-after-free errors.
-         */
-        //ast_command_line_free(cline);
-
-        // We will be modifying the job structures: we need to block SIGCHLD.
-        signal_block(SIGCHLD);
-
-        // foreach pipeline (job)
-        for (struct list_elem *pipeline_l_elem = list_begin(&cline->pipes); 
-             pipeline_l_elem != list_end (&cline->pipes); 
-             pipeline_l_elem = list_next(pipeline_l_elem)) {
-            
-            struct job *job = NULL;
-            struct ast_pipeline *pipeline = list_entry(pipeline_l_elem, 
-                                                       struct ast_pipeline, 
-                                                       elem);
-            int prev_pipe[] = {STDIN_FILENO, -1};
-            pid_t pgrp = 0;
-
-            // foreach command
-            for (struct list_elem *command_l_elem = list_begin(&pipeline->commands);
-                 command_l_elem != list_end(&pipeline->commands);
-                 command_l_elem = list_next(command_l_elem)) {
-                
-                struct ast_command *command = list_entry(command_l_elem,
-                                                         struct ast_command,
-                                                         elem);
-
-                // Create pipe
-                // Note: We read from prev_pipe[PIPE_READ] and write to 
-                //       new_pipe[PIPE_WRITE]
-                int new_pipe[] = {-1, STDOUT_FILENO};
-                if (command_l_elem != list_rbegin(&pipeline->commands)) {
-                    rc = pipe2(new_pipe, 0);
-                    if (rc < 0) {
-                        perror("pipe2 error");
-                        exit_builtin(STDIN_FILENO, STDOUT_FILENO);
-                    }
-                }
 
-                // Builtin: exit
-                if (strcmp(command->argv[0], "exit") == 0) {
-                    exit_builtin(prev_pipe[PIPE_READ], STDOUT_FILENO);
-                }
+/**
+ * is_parallel
+ * Returns true if pipeline is a lone "parallel" command.
+ */
+static bool is_parallel(struct ast_pipeline *pipeline) {
+    if (list_size(&pipeline->commands) != 1)
+        return false;
+
+    struct ast_command *command = list_entry(list_front(&pipeline->commands),
+                                             struct ast_command, elem);
+    const struct builtin *builtin = 
+        builtin_table_lookup(&builtin_table, command->argv[0]);
+    return builtin != NULL && builtin->run == parallel_builtin;
+}
 
-                else if (strcmp(command->argv[0], "jobs") == 0) {
-                    jobs_builtin(prev_pipe[PIPE_READ], new_pipe[PIPE_WRITE]);
-                }
 
-                else if (strcmp(command->argv[0], "kill") == 0) {
-                    kill_builtin(command->argv);
-                }
 
-                else if (strcmp(command->argv[0], "bg") == 0) {
-                    bg_builtin(command->argv);
-                }
-                
-                else if (strcmp(command->argv[0], "fg") == 0) {
-                    fg_builtin(command->argv);
-                }
+/**
+ * spawn_pipeline
+ * Launches all commands of a pipeline that contains no builtins with a
+ * single posix_spawn_pipeline_np call, which creates the pipes and puts
+ * every stage into the first stage's process group. The processes are 
+ * added to job, or to a new job if job is NULL.
+ * Return Value: The job, or NULL if no process could be spawned.
+ */
+static struct job *spawn_pipeline(struct ast_pipeline *pipeline, 
+                                  struct job *job, char *envp[],
+                                  const struct spawn_options *opts) {
+
+    int nstages = list_size(&pipeline->commands);
+    struct posix_spawn_stage stages[nstages];
+    posix_spawn_file_actions_t file_actions[nstages];
+    struct ast_command *commands[nstages];
+
+    // Stages only need file actions for I/O redirection - the pipes
+    // between them are set up by libspawn.
+    int no_pipe_in[] = {STDIN_FILENO, -1};
+    int no_pipe_out[] = {-1, STDOUT_FILENO};
+    int i = 0;
+    for (struct list_elem *e = list_begin(&pipeline->commands);
+         e != list_end(&pipeline->commands);
+         e = list_next(e), i++) {
+
+        commands[i] = list_entry(e, struct ast_command, elem);
+        file_actions[i] = setup_file_actions(pipeline, commands[i],
+                                             no_pipe_in, no_pipe_out);
+        stages[i].file = commands[i]->argv[0];
+        stages[i].path = cmd_table_resolve(&cmd_hash_table, 
+                                           commands[i]->argv[0]);
+        stages[i].argv = commands[i]->argv;
+        stages[i].file_actions = &file_actions[i];
+    }
 
-                else if (strcmp(command->argv[0], "stop") == 0) {
-                    stop_builtin(command->argv);
-                }
+    posix_spawnattr_t spawnattr = setup_spawnattr(0, !pipeline->bg_job, opts);
+    posix_spawn_pipeline_np(stages, nstages, &spawnattr, envp);
+    posix_spawnattr_destroy(&spawnattr);
+
+    for (i = 0; i < nstages; i++) {
+        posix_spawn_file_actions_destroy(&file_actions[i]);
+        // Only a remembered path that could not be exec'ed is stale; the
+        // stage may still have run from the PATH search that followed
+        if (stages[i].path_err != 0)
+            cmd_table_forget(&cmd_hash_table, commands[i]->argv[0]);
+        if (stages[i].err != 0) {
+            report_spawn_error(commands[i], stages[i].err);
+            continue;
+        }
+        pid_t pgrp = job && job->procs ? job->pgid : stages[i].pid;
+        add_process(&job, pipeline, commands[i], pgrp, 
+                    stages[i].pid, stages[i].pidfd);
+    }
+    return job && job->procs ? job : NULL;
+}
 
-                else if (strcmp(command->argv[0], "history") == 0) {
-                    history_builtin(command->argv);
-                }
-                
-                else if (strcmp(command->argv[0], "cd") == 0) {
-                    cd_builtin(command->argv);
-                }
 
-                // Not a builtin: execute external program
-                else {
-                    
-                    // setup posix spawn file actions and attr structs
-                    posix_spawn_file_actions_t file_actions = 
-                        setup_file_actions(pipeline,
-                                           command, 
-                                           prev_pipe, 
-                                           new_pipe);
-                    posix_spawnattr_t spawnattr = setup_spawnattr(pipeline,
-                                                                  pgrp);
-
-                    // call posix_spawn
-                    pid_t proc_pid;
-                    int rc = posix_spawnp(&proc_pid,
-                                          command->argv[0],
-                                          &file_actions,
-                                          &spawnattr,
-                                          command->argv, 
-                                          envp);
-                    if (rc == ENOENT) {
-                        printf("%s: No such file or directory\n", command->argv[0]);
-                        fflush(stdout);
-                    }
-                    else if (rc != 0) {
-                        fprintf(stderr, "posix_spawnp error: %d\n", rc);
-                        fflush(stderr);
-                        exit_builtin(STDIN_FILENO, STDOUT_FILENO);
-                    }
-                    else { // Process created successfully
-                        
-                        if (pgrp == 0) {
-                            pgrp = proc_pid;
-                        }
-
-                        // Create job struct if necessary
-                        if (job == NULL) {
-                            job = add_job(pipeline);
-                            job->pgid = pgrp;
-                            job->procs = malloc(sizeof(struct job) * 
-                                                list_size(&pipeline->commands));
-                            job->status = 
-                                pipeline->bg_job ? BACKGROUND : FOREGROUND;
-                            termstate_save(&job->saved_tty_state);
-                        }
-
-                        // Add process to the job struct
-                        process_t *proc = &job->procs[job->num_processes_alive];
-                        proc->pid = proc_pid;
-                        proc->status = PSTAT_RUNNING;
-                        proc->command = command;
-                        job->num_processes_alive++;
-                    }
-
-                    // close prev_pipe
-                    close_pipe(prev_pipe);
-
-                    // new_pipe is now prev_pipe
-                    memcpy(prev_pipe, new_pipe, sizeof(int) * 2);
-                }
-            } // foreach command
-
-            // Wait for job in fg
-            if (!pipeline->bg_job && job) {
-                termstate_give_terminal_to(&job->saved_tty_state, pgrp);
-                wait_for_job(job);
-                // Delete job struct
-                if (job->status == TERMINATED) {
-                    free(job->procs);
-                    list_remove(&job->elem);
-                    delete_job(job);
-                }
-            }
 
-            else if (pipeline->bg_job && job) {
-                printf("[%d] %d\n", job->jid, job->pgid);
-                fflush(stdout);
-            }
+/**
+ * queue_job
+ * Creates a QUEUED job for a background pipeline that has to wait for a
+ * slot. Nothing is spawned until start_queued_jobs gets to it.
+ */
+static struct job *queue_job(struct ast_pipeline *pipeline, char *envp[]) {
+    struct job *job = add_job(pipeline);
+    job->status = QUEUED;
+    job->envp = envp;
+    list_push_back(&job_queue, &job->queue_elem);
+    return job;
+}
 
-        } // foreach pipeline (job)
 
 
-        // Unblock SIGCHLD so that we can reap children while waiting 
-        // at the prompt (damn that sounds awful...)
-        signal_unblock(SIGCHLD);
-        
-        // We're gonna return to the prompt - reclaim the terminal
-        termstate_give_terminal_back_to_shell();
+/**
+ * start_job
+ * Spawns the processes of a QUEUED job, running its builtins or its first
+ * parallel items as if it had just been entered. If take_slot is set, the
+ * job counts against jobs_max from now on. A job none of whose processes 
+ * could be spawned is deleted.
+ * Return Value: Non-zero (true) if the job is now running.
+ */
+static bool start_job(struct job *job, bool take_slot) {
+    assert(job->status == QUEUED);
+    list_remove(&job->queue_elem);
+    job->status = BACKGROUND;
+
+    if (job->batch)
+        parallel_refill(job);
+    else if (pipeline_has_builtin(job->pipe))
+        run_pipeline_commands(job->pipe, job, job->envp, &job->spawn_opts);
+    else
+        spawn_pipeline(job->pipe, job, job->envp, &job->spawn_opts);
+    if (job->num_procs == 0) {
+        list_remove(&job->elem);
+        delete_job(job);
+        return false;
+    }
+    if (take_slot) {
+        job->has_slot = true;
+        jobs_running++;
     }
+    arm_timeout(job);
+    return true;
 }
 
 
 
 /**
- * main
- * Execution starts here.
+ * start_queued_jobs
+ * Starts QUEUED jobs, oldest first, while there are free slots. 
  */
-int main(int ac, char *av[], char *envp[]) {
+static void start_queued_jobs(void) {
+    while (!exiting && !list_empty(&job_queue) 
+           && (jobs_max == 0 || jobs_running < jobs_max)) {
+        struct job *job = list_entry(list_front(&job_queue), 
+                                     struct job, queue_elem);
+        start_job(job, true);
+    }
+}
 
-    int opt;
 
-    /* Process command-line arguments. See getopt(3) */
-    while ((opt = getopt(ac, av, "h")) > 0) {
-        switch (opt) {
-        case 'h':
-            usage(av[0]);
+
+/* parallel_batch: What a job started by "parallel" still has to run. Item
+                   i runs as the template with every "{}" replaced by 
+                   items[i] (or with items[i] appended if there is no {}).
+                   With -k, each item's output is held in a memfd and 
+                   written out once all items before it are done. */
+struct parallel_batch {
+    char **template;        /* command words */
+    int ntemplate;
+    bool has_placeholder;   /* some word contains {} */
+    char **items;
+    int nitems;
+    char *input;            /* buffer the items were read into, or NULL */
+    int next_item;          /* first item not started yet */
+    int max_procs;          /* -j: processes to keep running */
+    bool keep_order;        /* -k */
+    bool cancelled;         /* an item was killed, start no more */
+    int out_fd;             /* where the items' output goes */
+    int null_fd;            /* /dev/null, every item's stdin */
+    int *item_fd;           /* -k: memfd with item i's output, or -1 */
+    bool *item_done;
+    int next_output;        /* -k: first item not written out yet */
+    int *proc_item;         /* the item job->procs[i] runs */
+    char **envp;
+};
+
+
+
+/**
+ * parallel_argv
+ * Builds the command words of item from the batch's template, in arena.
+ */
+static char **parallel_argv(struct parallel_batch *batch, int item,
+                            struct ast_arena *arena) {
+    const char *value = batch->items[item];
+    size_t valuelen = strlen(value);
+    char **argv = ast_arena_alloc(arena, 
+                                  (batch->ntemplate + 2) * sizeof *argv);
+    int argc = 0;
+
+    for (int i = 0; i < batch->ntemplate; i++) {
+        char *word = batch->template[i];
+        int n = 0;
+        for (char *p = strstr(word, "{}"); p; p = strstr(p + 2, "{}"))
+            n++;
+        if (n == 0) {
+            argv[argc++] = word;
+            continue;
+        }
+
+        char *arg = ast_arena_alloc(arena, strlen(word) 
+                                           + n * (valuelen - 2) + 1);
+        char *q = arg, *p = word;
+        for (char *hole; (hole = strstr(p, "{}")) != NULL; p = hole + 2) {
+            memcpy(q, p, hole - p);
+            q += hole - p;
+            memcpy(q, value, valuelen);
+            q += valuelen;
+        }
+        strcpy(q, p);
+        argv[argc++] = arg;
+    }
+    if (!batch->has_placeholder)
+        argv[argc++] = batch->items[item];
+    argv[argc] = NULL;
+    return argv;
+}
+
+
+
+/**
+ * copy_fd
+ * Writes the contents of the file open at fd to out_fd. sendfile does 
+ * the copy unless out_fd is in append mode, which it refuses.
+ */
+static void copy_fd(int out_fd, int fd) {
+    off_t offset = 0;
+    ssize_t n;
+    while ((n = sendfile(out_fd, fd, &offset, 1 << 30)) != 0) {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
             break;
+    }
+    if (n == 0)
+        return;
+
+    char buf[8192];
+    while ((n = pread(fd, buf, sizeof buf, offset)) != 0) {
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return;
+        offset += n;
+        for (char *p = buf; n > 0; ) {
+            ssize_t w = write(out_fd, p, n);
+            if (w < 0 && errno == EINTR)
+                continue;
+            if (w < 0)
+                return;
+            p += w;
+            n -= w;
         }
     }
+}
+
+
+
+/**
+ * parallel_flush_output
+ * Writes out, in item order, the buffered output of the items that are 
+ * done.
+ */
+static void parallel_flush_output(struct parallel_batch *batch) {
+    if (batch->out_fd == STDOUT_FILENO)
+        fflush(stdout);
+
+    while (batch->next_output < batch->next_item 
+           && batch->item_done[batch->next_output]) {
+        int fd = batch->item_fd[batch->next_output++];
+        if (fd == -1)
+            continue;
+
+        copy_fd(batch->out_fd, fd);
+        close(fd);
+    }
+}
+
+
+
+/**
+ * parallel_spawn_item
+ * Starts the next item of job's batch in the job's process group, or in 
+ * a new one if none of the job's processes is left to keep the old one
+ * alive.
+ */
+static void parallel_spawn_item(struct job *job) {
+    struct parallel_batch *batch = job->batch;
+    int item = batch->next_item++;
+    struct ast_command *command = ast_command_create(job->pipe->arena,
+        parallel_argv(batch, item, job->pipe->arena), false);
+
+    int in[] = {batch->null_fd, -1};
+    int out[] = {-1, batch->out_fd};
+    batch->item_fd[item] = -1;
+    if (batch->keep_order) {
+        batch->item_fd[item] = memfd_create("cush-parallel", MFD_CLOEXEC);
+        if (batch->item_fd[item] == -1)
+            utils_fatal_error("cannot buffer parallel output: ");
+        out[PIPE_WRITE] = batch->item_fd[item];
+    }
+
+    pid_t pgrp = job->num_processes_alive > 0 ? job->pgid : 0;
+    posix_spawn_file_actions_t file_actions = 
+        setup_file_actions(job->pipe, command, in, out);
+    posix_spawnattr_t spawnattr = setup_spawnattr(pgrp, 
+                                                  job->status == FOREGROUND,
+                                                  &job->spawn_opts);
+    pid_t pid;
+    int pidfd;
+    int rc = spawn_command(&pid, &pidfd, command, &file_actions, 
+                           &spawnattr, batch->envp);
+    posix_spawn_file_actions_destroy(&file_actions);
+    posix_spawnattr_destroy(&spawnattr);
+
+    if (rc != 0) {
+        report_spawn_error(command, rc);
+        batch->item_done[item] = true;
+        return;
+    }
+    if (pgrp == 0)
+        job->pgid = pid;
+    batch->proc_item[job->num_procs] = item;
+    add_process(&job, job->pipe, command, job->pgid, pid, pidfd);
+}
+
+
+
+/**
+ * parallel_refill
+ * Starts items until max_procs of job's processes are alive or no items
+ * are left.
+ */
+static void parallel_refill(struct job *job) {
+    struct parallel_batch *batch = job->batch;
+    while (!exiting && !batch->cancelled && batch->next_item < batch->nitems
+           && job->num_processes_alive < batch->max_procs)
+        parallel_spawn_item(job);
+}
+
+
+
+/**
+ * parallel_reap
+ * Called when proc, one of the processes of a parallel job, has been 
+ * reaped with status. Writes out the output that is now in order and
+ * starts the next items, unless the job is stopped (fg and bg refill it 
+ * then) or an item was killed by a signal meant to end the whole batch.
+ */
+static void parallel_reap(struct job *job, process_t *proc, int status) {
+    struct parallel_batch *batch = job->batch;
+    batch->item_done[batch->proc_item[proc - job->procs]] = true;
+
+    if (WIFSIGNALED(status)) {
+        int sig = WTERMSIG(status);
+        if (sig == SIGINT || sig == SIGTERM || sig == SIGKILL 
+            || sig == SIGHUP || sig == SIGQUIT)
+            batch->cancelled = true;
+    }
+    if (batch->keep_order)
+        parallel_flush_output(batch);
+
+    // A stopped job with no process left would otherwise count as done
+    if ((job->status != STOPPED && job->status != NEEDSTERMINAL)
+        || job->num_processes_alive == 0)
+        parallel_refill(job);
+}
+
+
+
+/**
+ * parallel_batch_free
+ * Writes out whatever output is still buffered and releases the batch.
+ */
+static void parallel_batch_free(struct parallel_batch *batch) {
+    if (batch->keep_order) {
+        parallel_flush_output(batch);
+        for (int i = batch->next_output; i < batch->next_item; i++) {
+            if (batch->item_fd[i] != -1)
+                close(batch->item_fd[i]);
+        }
+    }
+    if (batch->out_fd != STDOUT_FILENO)
+        close(batch->out_fd);
+    close(batch->null_fd);
+    free(batch->items);
+    free(batch->input);
+    free(batch->item_fd);
+    free(batch->item_done);
+    free(batch->proc_item);
+    free(batch);
+}
+
+
+
+/**
+ * parallel_read_items
+ * Reads the lines of fd into batch->input and makes each non-empty line
+ * an item.
+ * Return Value: 0 on success, -1 on a read error.
+ */
+static int parallel_read_items(struct parallel_batch *batch, int fd) {
+    size_t len = 0, size = 0;
+    for (;;) {
+        if (len + 1 >= size) {
+            size = size ? 2 * size : 65536;
+            batch->input = realloc(batch->input, size);
+            if (batch->input == NULL)
+                utils_fatal_error("cannot read parallel items: ");
+        }
+        ssize_t n = read(fd, batch->input + len, size - len - 1);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0)
+            return -1;
+        if (n == 0)
+            break;
+        len += n;
+    }
+    batch->input[len] = '\0';
+
+    int capacity = 0;
+    for (char *line = batch->input, *end; *line; line = end) {
+        end = strchrnul(line, '\n');
+        if (*end)
+            *end++ = '\0';
+        if (*line == '\0')
+            continue;
+        if (batch->nitems == capacity) {
+            capacity = capacity ? 2 * capacity : 256;
+            batch->items = realloc(batch->items, 
+                                   capacity * sizeof *batch->items);
+            if (batch->items == NULL)
+                utils_fatal_error("cannot read parallel items: ");
+        }
+        batch->items[batch->nitems++] = line;
+    }
+    return 0;
+}
+
+
+
+/**
+ * parallel_usage
+ * Complains about the arguments of parallel.
+ */
+static struct job *parallel_usage(struct parallel_batch *batch) {
+    printf("usage: parallel [-j N] [-k] command [args...] [::: items...]\n");
+    fflush(stdout);
+    free(batch);
+    return NULL;
+}
+
+
+
+/**
+ * run_parallel
+ * Runs "parallel [-j N] [-k] command [args...] [::: items...]": starts
+ * command once per item, N at a time (one per CPU by default), as a 
+ * single job. Items are the words after :::, or else the lines read from
+ * the pipeline's input redirection or the shell's stdin. With -k, the 
+ * output of the items is written in item order. Every item is spawned
+ * with opts. If queue is set, the items are collected but the job is 
+ * QUEUED instead of started.
+ * Return Value: The job, or NULL if nothing was started.
+ */
+static struct job *run_parallel(struct ast_pipeline *pipeline, 
+                                char *envp[], 
+                                const struct spawn_options *opts,
+                                bool queue) {
+    struct ast_command *command = list_entry(list_front(&pipeline->commands),
+                                             struct ast_command, elem);
+    char **argv = command->argv;
+
+    struct parallel_batch *batch = calloc(1, sizeof *batch);
+    if (batch == NULL)
+        utils_fatal_error("cannot start parallel: ");
+    batch->max_procs = sysconf(_SC_NPROCESSORS_ONLN);
+    batch->envp = envp;
+
+    int i = 1;
+    for (; argv[i] != NULL && argv[i][0] == '-'; i++) {
+        const char *jobs = NULL;
+        if (!strcmp(argv[i], "-k"))
+            batch->keep_order = true;
+        else if (!strcmp(argv[i], "-j") && argv[i + 1] != NULL)
+            jobs = argv[++i];
+        else if (!strncmp(argv[i], "-j", 2) && argv[i][2] != '\0')
+            jobs = argv[i] + 2;
+        else if (!strcmp(argv[i], "--")) {
+            i++;
+            break;
+        }
+        else
+            return parallel_usage(batch);
+
+        if (jobs != NULL) {
+            char *end;
+            long n = strtol(jobs, &end, 10);
+            if (*jobs == '\0' || *end != '\0' || n < 1 || n > INT_MAX)
+                return parallel_usage(batch);
+            batch->max_procs = n;
+        }
+    }
+
+    batch->template = &argv[i];
+    while (argv[i] != NULL && strcmp(argv[i], ":::") != 0) {
+        if (strstr(argv[i], "{}") != NULL)
+            batch->has_placeholder = true;
+        batch->ntemplate++;
+        i++;
+    }
+    if (batch->ntemplate == 0)
+        return parallel_usage(batch);
+
+    // Collect the items
+    if (argv[i] != NULL) {
+        for (i++; argv[i] != NULL; i++) {
+            batch->items = realloc(batch->items, 
+                                   (batch->nitems + 1) * sizeof *batch->items);
+            if (batch->items == NULL)
+                utils_fatal_error("cannot start parallel: ");
+            batch->items[batch->nitems++] = argv[i];
+        }
+    }
+    else {
+        int fd = STDIN_FILENO;
+        if (pipeline->iored_input != NULL) {
+            fd = open(pipeline->iored_input, O_RDONLY | O_CLOEXEC);
+            if (fd == -1) {
+                perror(pipeline->iored_input);
+                free(batch);
+                return NULL;
+            }
+        }
+        int rc = parallel_read_items(batch, fd);
+        if (rc < 0)
+            perror("parallel");
+        if (fd != STDIN_FILENO)
+            close(fd);
+        if (rc < 0) {
+            free(batch->items);
+            free(batch->input);
+            free(batch);
+            return NULL;
+        }
+    }
+
+    batch->out_fd = STDOUT_FILENO;
+    if (pipeline->iored_output != NULL) {
+        int o_flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+        o_flags |= pipeline->append_to_output ? O_APPEND : O_TRUNC;
+        batch->out_fd = open(pipeline->iored_output, o_flags, 0666);
+    }
+    batch->null_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    batch->item_fd = malloc(batch->nitems * sizeof *batch->item_fd);
+    batch->item_done = calloc(batch->nitems, sizeof *batch->item_done);
+    batch->proc_item = malloc(batch->nitems * sizeof *batch->proc_item);
+    if (batch->out_fd == -1 || batch->nitems == 0) {
+        if (batch->out_fd == -1) {
+            perror(pipeline->iored_output);
+            batch->out_fd = STDOUT_FILENO;
+        }
+        parallel_batch_free(batch);
+        return NULL;
+    }
+    if (batch->null_fd == -1 || batch->item_fd == NULL 
+        || batch->item_done == NULL || batch->proc_item == NULL)
+        utils_fatal_error("cannot start parallel: ");
+
+    // One job for the whole batch, with room for a process per item
+    struct job *job = add_job(pipeline);
+    job->procs = malloc(batch->nitems * sizeof *job->procs);
+    if (job->procs == NULL)
+        utils_fatal_error("cannot start parallel: ");
+    job->status = pipeline->bg_job ? BACKGROUND : FOREGROUND;
+    if (interactive)
+        termstate_save(&job->saved_tty_state);
+    job->batch = batch;
+    job->spawn_opts = *opts;
+    num_batches++;
+    if (queue) {
+        job->status = QUEUED;
+        job->envp = envp;
+        list_push_back(&job_queue, &job->queue_elem);
+        return job;
+    }
+
+    parallel_refill(job);
+    if (job->num_procs == 0) {
+        list_remove(&job->elem);
+        delete_job(job);
+        return NULL;
+    }
+    return job;
+}
+
+
+
+/**
+ * builtin_output_open
+ * Starts collecting output that will go to fd.
+ */
+static struct builtin_output *builtin_output_open(int fd) {
+    struct builtin_output *out = malloc(sizeof *out);
+    if (out == NULL)
+        utils_fatal_error("cannot buffer builtin output: ");
+    out->fd = fd;
+    out->done = 0;
+    out->stream = open_memstream(&out->buf, &out->len);
+    if (out->stream == NULL)
+        utils_fatal_error("cannot buffer builtin output: ");
+    return out;
+}
+
+
+
+/**
+ * builtin_output_free
+ * Closes out's fd unless it is one of the shell's own, and frees out.
+ */
+static void builtin_output_free(struct builtin_output *out) {
+    free(out->buf);
+    if (out->fd > STDERR_FILENO)
+        close(out->fd);
+    free(out);
+}
+
+
+
+/**
+ * builtin_output_write
+ * Writes as much of the rest of out's output as its fd takes. Output to 
+ * a pipe whose reader has gone away is dropped; the resulting SIGPIPE 
+ * stays blocked (see main).
+ * Return Value: Non-zero (true) if nothing is left to write.
+ */
+static bool builtin_output_write(struct builtin_output *out) {
+    while (out->done < out->len) {
+        ssize_t n = write(out->fd, out->buf + out->done, 
+                          out->len - out->done);
+        if (n < 0 && errno == EINTR)
+            continue;
+        if (n < 0 && errno == EAGAIN)
+            return false;
+        if (n < 0)
+            break;
+        out->done += n;
+    }
+    return true;
+}
+
+
+
+/**
+ * builtin_output_ready
+ * Called by the event loop, or by wait_for_job, once the pipe that 
+ * pending output goes to has room again.
+ */
+static void builtin_output_ready(int fd, void *data) {
+    struct builtin_output *out = data;
+    if (!builtin_output_write(out))
+        return;
+    event_loop_remove(fd);
+    list_remove(&out->elem);
+    builtin_output_free(out);
+}
+
+
+
+/**
+ * builtin_output_deliver
+ * Writes the collected output to its fd. Whatever does not fit into a 
+ * pipe is written as its reader drains it, since the reader may be 
+ * stopped and the shell has to go on waiting for its jobs meanwhile.
+ */
+static void builtin_output_deliver(struct builtin_output *out) {
+    fclose(out->stream);
+    if (out->fd == STDOUT_FILENO)
+        fflush(stdout);
+
+    // The shell's own fds stay blocking
+    if (out->fd > STDERR_FILENO)
+        fcntl(out->fd, F_SETFL, fcntl(out->fd, F_GETFL) | O_NONBLOCK);
+    if (builtin_output_write(out)) {
+        builtin_output_free(out);
+        return;
+    }
+    list_push_back(&pending_outputs, &out->elem);
+    event_loop_add_output(out->fd, builtin_output_ready, out);
+}
+
 
-    list_init(&job_list);
-    signal_set_handler(SIGCHLD, sigchld_handler);
-    termstate_init();
-    using_history();
 
+/**
+ * run_pipeline_commands
+ * Runs the commands of a pipeline one at a time: builtins in the shell,
+ * everything else via spawn_command, connected through pipes. The 
+ * processes are added to job, or to a new job if job is NULL.
+ * A builtin writing into a pipe would block once the pipe is full, since
+ * its reader may not exist yet, so its output is held back until every
+ * stage has been started, and then written without blocking.
+ * Return Value: The job, or NULL if no process was spawned.
+ */
+static struct job *run_pipeline_commands(struct ast_pipeline *pipeline,
+                                         struct job *job, char *envp[],
+                                         const struct spawn_options *opts) {
+
+    int rc;
+    int prev_pipe[] = {STDIN_FILENO, -1};
+    pid_t pgrp = 0;
+    struct builtin_output *pending[list_size(&pipeline->commands)];
+    int npending = 0;
+
+    // foreach command
+    for (struct list_elem *command_l_elem = list_begin(&pipeline->commands);
+         command_l_elem != list_end(&pipeline->commands);
+         command_l_elem = list_next(command_l_elem)) {
+
+        struct ast_command *command = list_entry(command_l_elem,
+                                                 struct ast_command,
+                                                 elem);
+
+        // Create pipe
+        // Note: We read from prev_pipe[PIPE_READ] and write to 
+        //       new_pipe[PIPE_WRITE]
+        int new_pipe[] = {-1, STDOUT_FILENO};
+        bool last = command_l_elem == list_rbegin(&pipeline->commands);
+        if (!last) {
+            rc = make_pipe(new_pipe);
+            if (rc < 0) {
+                perror("pipe2 error");
+                exit_shell();
+            }
+        }
+
+        const struct builtin *builtin = 
+            builtin_table_lookup(&builtin_table, command->argv[0]);
+        if (builtin != NULL) {
+
+            // The last stage honors the pipeline's output redirection
+            int out_fd = new_pipe[PIPE_WRITE];
+            if (last && pipeline->iored_output != NULL) {
+                int o_flags = O_WRONLY | O_CREAT | O_CLOEXEC;
+                o_flags |= pipeline->append_to_output ? O_APPEND : O_TRUNC;
+                out_fd = open(pipeline->iored_output, o_flags, 0666);
+                if (out_fd == -1)
+                    perror(pipeline->iored_output);
+            }
+
+            if (out_fd != -1) {
+                struct builtin_output *out = builtin_output_open(out_fd);
+                builtin->run(command->argv, out->stream);
+
+                if (last)
+                    builtin_output_deliver(out);
+                else {
+                    pending[npending++] = out;
+                    new_pipe[PIPE_WRITE] = -1;  // now owned by out
+                }
+            }
+        }
+
+        // Not a builtin: execute external program
+        else {
+
+            // setup posix spawn file actions and attr structs
+            posix_spawn_file_actions_t file_actions = 
+                setup_file_actions(pipeline,
+                                   command, 
+                                   prev_pipe, 
+                                   new_pipe);
+            posix_spawnattr_t spawnattr = setup_spawnattr(pgrp,
+                                                          !pipeline->bg_job,
+                                                          opts);
+
+            // call posix_spawn
+            pid_t proc_pid;
+            int proc_pidfd;
+            int rc = spawn_command(&proc_pid,
+                                   &proc_pidfd,
+                                   command,
+                                   &file_actions,
+                                   &spawnattr,
+                                   envp);
+            if (rc != 0) {
+                report_spawn_error(command, rc);
+            }
+            else { // Process created successfully
+                if (pgrp == 0) {
+                    pgrp = proc_pid;
+                }
+                add_process(&job, pipeline, command, pgrp, proc_pid, proc_pidfd);
+            }
+            posix_spawn_file_actions_destroy(&file_actions);
+            posix_spawnattr_destroy(&spawnattr);
+        }
+
+        // close prev_pipe
+        close_pipe(prev_pipe);
+
+        // new_pipe is now prev_pipe
+        memcpy(prev_pipe, new_pipe, sizeof(int) * 2);
+    } // foreach command
+
+    // Every reader is running now
+    for (int i = 0; i < npending; i++)
+        builtin_output_deliver(pending[i]);
+
+    return job && job->procs ? job : NULL;
+}
+
+
+
+/* completed_line: The line most recently accepted by readline, or NULL
+                   on EOF. Valid once line_complete is set. */
+static char *completed_line;
+static bool line_complete;
+
+
+
+/**
+ * line_handler
+ * Called by readline once the user has entered a complete line.
+ */
+static void line_handler(char *line) {
+    rl_callback_handler_remove();
+    completed_line = line;
+    line_complete = true;
+}
+
+
+
+/**
+ * stdin_ready
+ * Event loop handler for terminal input: let readline consume it.
+ */
+static void stdin_ready(int fd, void *data) {
+    rl_callback_read_char();
+}
+
+
+
+/**
+ * read_command_line
+ * Prints the prompt and runs the event loop until readline has read a
+ * complete line. Children that change state while the user is typing are
+ * handled along the way.
+ * Return Value: The line (to be freed by the caller), or NULL on EOF.
+ */
+static char *read_command_line(void) {
+
+    /* Do not output a prompt unless shell's stdin is a terminal */
+    flush_notifications();
+    char *prompt = isatty(0) ? build_prompt() : NULL;
+    rl_callback_handler_install(prompt ? prompt : "", line_handler);
+    free (prompt);
+
+    line_complete = false;
+    event_loop_add(STDIN_FILENO, stdin_ready, NULL);
+    while (!line_complete)
+        event_loop_dispatch(-1);
+    event_loop_remove(STDIN_FILENO);
+
+    return completed_line;
+}
+
+
+
+/**
+ * run_command_line
+ * Parses cmdline and runs the jobs it describes, waiting for the 
+ * foreground ones. This is where all the job creation magic happens.
+ */
+static void run_command_line(char *cmdline, char *envp[]) {
+
+    struct ast_command_line *cline = parse_cache_parse(&parse_cache, cmdline);
+    if (cline == NULL)                  /* Error in command line */
+        return;
+
+    if (list_empty(&cline->pipes)) {    /* User hit enter */
+        ast_command_line_free(cline);
+        return;
+    }
+
+    //ast_command_line_print(cline);      /* Output a representation of
+    //                                       the entered command line */
+
+    // foreach pipeline (job)
+    for (struct list_elem *pipeline_l_elem = list_begin(&cline->pipes); 
+         pipeline_l_elem != list_end (&cline->pipes); 
+         pipeline_l_elem = list_next(pipeline_l_elem)) {
+        
+        struct ast_pipeline *pipeline = list_entry(pipeline_l_elem, 
+                                                   struct ast_pipeline, 
+                                                   elem);
+
+        double timeout = 0, grace = TIMEOUT_GRACE;
+        struct spawn_options opts = { .policy = -1 };
+        strip_prefixes(pipeline, &timeout, &grace, &opts);
+        glob_expand_pipeline(pipeline);
+        // Background jobs wait for a slot, except for those that are 
+        // made of builtins only and spawn nothing
+        bool queue = pipeline->bg_job && jobs_max > 0 
+                     && jobs_running >= jobs_max;
+        struct job *job;
+        if (is_parallel(pipeline))
+            job = run_parallel(pipeline, envp, &opts, queue);
+        else if (queue && pipeline_has_external(pipeline))
+            job = queue_job(pipeline, envp);
+        else if (pipeline_has_builtin(pipeline))
+            job = run_pipeline_commands(pipeline, NULL, envp, &opts);
+        else
+            job = spawn_pipeline(pipeline, NULL, envp, &opts);
+
+        if (job) {
+            job->timeout = timeout;
+            job->grace = grace;
+            job->spawn_opts = opts;
+        }
+        if (job && job->status == QUEUED) {
+            printf("[%d] queued\n", job->jid);
+            fflush(stdout);
+            continue;
+        }
+        if (job) {
+            if (pipeline->bg_job) {
+                job->has_slot = true;
+                jobs_running++;
+            }
+            arm_timeout(job);
+        }
+
+        // Wait for job in fg
+        if (!pipeline->bg_job && job) {
+            if (interactive)
+                termstate_give_terminal_to(&job->saved_tty_state, 
+                                           job->pgid);
+            wait_for_job(job);
+            // Report how it ended or stopped right away
+            flush_notifications();
+            // Delete job struct
+            if (job->status == TERMINATED) {
+                list_remove(&job->elem);
+                delete_job(job);
+            }
+        }
+
+        else if (pipeline->bg_job && job) {
+            printf("[%d] %d\n", job->jid, job->pgid);
+            fflush(stdout);
+        }
+
+    } // foreach pipeline (job)
+
+    /* Jobs retained their pipelines in add_job, so this frees the
+     * command line's arena only if none of them is still around. */
+    ast_command_line_free(cline);
+
+    // We're gonna return to the prompt - reclaim the terminal
+    if (interactive)
+        termstate_give_terminal_back_to_shell();
+}
+
+
+
+/**
+ * shell_loop
+ * Called by main to run the shell's interactive read/eval loop.
+ */
+static void shell_loop(char *envp[]) {
+
+    for (;;) {
+
+        /* SIGCHLD is blocked at all times. Background jobs that finish
+         * while the shell is sitting at the prompt are reaped by the event
+         * loop in read_command_line, which watches sigchld_fd.
+         */
+
+        /* If you fail this assertion, you were about to call readline()
+         * without having terminal ownership.
+         * This would lead to the suspension of your shell with SIGTTOU.
+         * Make sure that you call termstate_give_terminal_back_to_shell()
+         * before returning here on all paths.
+         */
+        assert(termstate_get_current_terminal_owner() == getpgrp());
+
+        char *cmdline = read_command_line();
+
+        if (cmdline == NULL)  /* User typed EOF */
+            break;
+
+        char *expanded = NULL;
     
-    shell_loop(envp);
+        int result = history_expand(cmdline, &expanded);
+
+        // Check if history expansion happened
+        if (result >= 0) {
+            free(cmdline);
+            cmdline = expanded;
+        } else {
+            printf("Error in history expansion\n");
+        }
+        
+        //Make sure to add history of commands
+        add_history(cmdline);
+
+        // Always free the expanded string
+        //free(expanded);
+        
+        run_command_line(cmdline, envp);
+        free(cmdline);
+    }
+}
+
+
+
+/**
+ * script_loop
+ * Called by main to run the commands read by reader, one line at a time.
+ * Bypasses readline and history.
+ */
+static void script_loop(struct line_reader *reader, char *envp[]) {
+
+    char *cmdline;
+    while ((cmdline = line_reader_next(reader)) != NULL) {
+        // Reap background jobs that finished since the last line
+        event_loop_dispatch(0);
+        flush_notifications();
+        run_command_line(cmdline, envp);
+    }
+
+    // Background readers of builtin output still get all of it
+    while (!list_empty(&pending_outputs))
+        event_loop_dispatch(-1);
+}
+
+
+
+/**
+ * main
+ * Execution starts here.
+ */
+int main(int ac, char *av[], char *envp[]) {
+
+    int opt;
+    char *command_string = NULL;
+
+    /* Process command-line arguments. See getopt(3) */
+    while ((opt = getopt(ac, av, "hc:")) > 0) {
+        switch (opt) {
+        case 'h':
+            usage(av[0]);
+            break;
+        case 'c':
+            command_string = optarg;
+            break;
+        default:
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* Commands come from -c, a script file, or a non-terminal stdin */
+    struct line_reader reader;
+    if (command_string != NULL) {
+        line_reader_init_string(&reader, command_string);
+    }
+    else if (optind < ac) {
+        int fd = open(av[optind], O_RDONLY | O_CLOEXEC);
+        if (fd == -1)
+            utils_fatal_error("%s: ", av[optind]);
+        line_reader_init_fd(&reader, fd);
+    }
+    else if (!isatty(STDIN_FILENO)) {
+        line_reader_init_fd(&reader, STDIN_FILENO);
+    }
+    else {
+        interactive = true;
+    }
+
+    list_init(&job_list);
+    list_init(&job_queue);
+    list_init(&pending_outputs);
+    pid_table_init(&pid2proc);
+    jid_table_init(&jid2job, MAXJOBS);
+    cmd_table_init(&cmd_hash_table);
+    builtin_table_init(&builtin_table, builtins, 
+                       sizeof builtins / sizeof builtins[0]);
+    parse_cache_init(&parse_cache);
+    notify_queue_init(&notifications);
+    event_loop_init();
+    signal_track_handlers();
+    /* A builtin writing into a pipe whose reader has exited must not kill
+     * the shell. Children start with an empty signal mask, and pending
+     * signals are not inherited, so this does not affect them. */
+    signal_block(SIGPIPE);
+    sigchld_fd = signal_create_fd(SIGCHLD);
+    event_loop_add(sigchld_fd, sigchld_ready, NULL);
+
+    if (interactive) {
+        termstate_init();
+        using_history();
+        shell_loop(envp);
+    }
+    else {
+        script_loop(&reader, envp);
+        line_reader_destroy(&reader);
+    }
 
     return 0;
 }
@@ -0,0 +1,90 @@
+#!/usr/bin/python
+#
+# Tests builtins used as pipeline stages and with output redirection
+#
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+#################################################################
+# 
+# Boilerplate ends here, now write your specific test.
+#
+#################################################################
+# Step 1. Start a background job that jobs can report
+#
+import tempfile, shutil, os
+tmpdir = tempfile.mkdtemp("-cush-builtin-pipe-tests")
+
+def cleanup():
+    shutil.rmtree(tmpdir)
+
+atexit.register(cleanup)
+
+sendline("sleep 100 &")
+expect(r"\[1\] \d+", "sleep 100 & did not report its job")
+expect_prompt("Shell did not print expected prompt after sleep 100 &")
+
+#################################################################
+# Step 2. The output of jobs can be piped into an external command
+#
+sendline("jobs | tr a-z A-Z")
+expect_exact("[1]\tRUNNING\t\t(SLEEP 100)", "jobs | tr did not see the job list")
+expect_prompt("Shell did not print expected prompt after jobs | tr")
+
+#################################################################
+# Step 3. The output of jobs can be redirected to a file
+#
+jobsfile = os.path.join(tmpdir, "jobs.txt")
+sendline("jobs > " + jobsfile)
+expect_prompt("Shell did not print expected prompt after jobs > file")
+
+sendline("cat " + jobsfile)
+expect_exact("[1]\tRunning\t\t(sleep 100)", "jobs > file did not write the job list")
+expect_prompt("Shell did not print expected prompt after cat")
+
+#################################################################
+# Step 4. A reader that exits early does not take down the shell
+#
+sendline("history | true")
+expect_prompt("Shell did not print expected prompt after history | true")
+
+sendline("kill 1")
+expect_prompt("Shell did not print expected prompt after kill 1")
+
+#################################################################
+# Step 5. Output that does not fit into the pipe reaches its reader,
+#         and a reader that stops does not keep the shell from waiting
+#         for it
+#
+sendline("set pipesize=4096")
+expect_prompt("Shell did not print expected prompt after set pipesize")
+
+for i in range(80):
+    sendline("echo %02d-----------------------------------------------------" % i)
+    expect_prompt("Shell did not print expected prompt after echo")
+
+sendline("history | wc -l")
+expect(r"\b8\d\b", "history | wc did not read all of the history")
+expect_prompt("Shell did not print expected prompt after history | wc")
+
+sendline("history | sleep 100")
+time.sleep(0.5)
+sendcontrol('z')
+expect("Stopped", "history | sleep was not stopped")
+expect_prompt("Shell did not return to the prompt after ^Z")
+
+sendline("jobs")
+expect(r"\[(\d+)\]\s+Stopped\s+\(history\| sleep 100\)", 
+       "history | sleep is not listed as stopped")
+jobid = console.match.group(1)
+expect_prompt("Shell did not print expected prompt after jobs")
+
+run_builtin('kill', jobid)
+expect_prompt("Shell did not print expected prompt after kill")
+
+test_success()
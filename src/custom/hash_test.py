@@ -0,0 +1,101 @@
+#!/usr/bin/python
+#
+# Tests the functionality of the hash builtin
+#
+import atexit, proc_check, time
+import os, shutil, tempfile
+from testutils import *
+
+# Two PATH directories to move a command between (step 6)
+tooldir = tempfile.mkdtemp("-cush-hash")
+os.mkdir(tooldir + "/p1")
+os.mkdir(tooldir + "/p2")
+with open(tooldir + "/p1/cush_hash_tool", "w") as f:
+    f.write("#!/bin/sh\necho tool ran\n")
+os.chmod(tooldir + "/p1/cush_hash_tool", 0o755)
+os.environ["PATH"] = (tooldir + "/p1:" + tooldir + "/p2:" 
+                      + os.environ["PATH"])
+atexit.register(shutil.rmtree, tooldir)
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+#################################################################
+# 
+# Boilerplate ends here, now write your specific test.
+#
+#################################################################
+# Step 1. A fresh shell has not remembered any commands yet
+#
+sendline("hash")
+expect_exact("hash: hash table empty", "hash did not report an empty table")
+expect_prompt("Shell did not print expected prompt after hash")
+
+#################################################################
+# Step 2. Run a command twice, it should be remembered with 2 hits
+#
+sendline("echo hello")
+expect_exact("hello", "echo hello did not work as expected")
+expect_prompt("Shell did not print expected prompt after echo hello")
+
+sendline("echo hello")
+expect_exact("hello", "echo hello did not work as expected")
+expect_prompt("Shell did not print expected prompt after echo hello")
+
+sendline("hash")
+expect(r"\s2\t\S*/echo", "hash did not list echo with 2 hits")
+expect_prompt("Shell did not print expected prompt after hash")
+
+#################################################################
+# Step 3. Unknown commands are reported
+#
+sendline("hash no_such_command_cush")
+expect_exact("hash: no_such_command_cush: not found",
+             "hash did not report a missing command")
+expect_prompt("Shell did not print expected prompt after hash name")
+
+#################################################################
+# Step 4. hash -r empties the table
+#
+sendline("hash -r")
+expect_prompt("Shell did not print expected prompt after hash -r")
+
+sendline("hash")
+expect_exact("hash: hash table empty", "hash -r did not empty the table")
+expect_prompt("Shell did not print expected prompt after hash")
+
+#################################################################
+# Step 5. The repeated lines above were served from the parse cache
+#
+sendline("hash -s")
+expect(r"parse cache: \d+ lines, [1-9]\d* hits", 
+       "hash -s did not report parse cache hits")
+expect_prompt("Shell did not print expected prompt after hash -s")
+
+#################################################################
+# Step 6. A remembered path that no longer works is dropped, and the
+#         command is found again where it went
+#
+sendline("cush_hash_tool")
+expect_exact("tool ran", "cush_hash_tool did not run")
+expect_prompt()
+
+os.rename(tooldir + "/p1/cush_hash_tool", tooldir + "/p2/cush_hash_tool")
+sendline("cush_hash_tool")
+expect_exact("tool ran", "moved cush_hash_tool did not run")
+expect_prompt()
+
+sendline("hash")
+expect_prompt("Shell did not print expected prompt after hash")
+assert "/p1/cush_hash_tool" not in console.before, "stale path was kept"
+
+sendline("cush_hash_tool")
+expect_exact("tool ran", "moved cush_hash_tool did not run")
+expect_prompt()
+sendline("hash")
+expect(r"\s1\t\S*/p2/cush_hash_tool", "new path was not remembered")
+expect_prompt("Shell did not print expected prompt after hash")
+
+test_success()
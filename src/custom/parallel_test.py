@@ -0,0 +1,63 @@
+#!/usr/bin/python
+#
+# Tests the parallel builtin
+#
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+#################################################################
+# 
+# Boilerplate ends here, now write your specific test.
+#
+#################################################################
+# Step 1. -k writes the output of the items in item order
+#
+sendline('parallel -k -j 2 sh -c "sleep 0.$0; echo item-$0" ::: 3 1 2')
+expect_exact("item-3\r\nitem-1\r\nitem-2\r\n", "parallel -k reordered output")
+expect_prompt("Shell did not print expected prompt after parallel -k")
+
+#################################################################
+# Step 2. Items are read from stdin, {} is replaced in every word
+#
+sendline("echo a > parallel_items.tmp")
+expect_prompt()
+sendline("parallel echo {}-{} < parallel_items.tmp")
+expect_exact("a-a\r\n", "parallel did not substitute {}")
+expect_prompt("Shell did not print expected prompt after parallel")
+sendline("rm parallel_items.tmp")
+expect_prompt()
+
+#################################################################
+# Step 3. A background batch is one job, and kill ends all of it
+#
+sendline("parallel -j 2 sleep ::: 30 30 30 30 &")
+(jobid, pid) = parse_bg_status()
+expect_prompt("Shell did not print expected prompt after starting batch")
+
+sendline("jobs -l")
+expect(r"\t" + pid + r"\s+Running[^\r\n]*sleep 30\r\n")
+expect(r"\t\d+\s+Running[^\r\n]*sleep 30\r\n")
+expect(r"\ttotal")
+expect_prompt("Shell did not print expected prompt after jobs -l")
+
+run_builtin('kill', jobid)
+expect_prompt("Shell did not print expected prompt after kill")
+time.sleep(0.5)
+sendline("jobs")
+expect_prompt("jobs still listed the killed batch")
+assert 'sleep' not in console.before, "batch was not ended by kill"
+
+#################################################################
+# Step 4. ^C in the foreground cancels the items not yet started
+#
+sendline("parallel -j 1 sleep ::: 30 30 30")
+time.sleep(0.5)
+sendintr()
+expect_prompt("^C did not end the foreground batch")
+
+test_success()
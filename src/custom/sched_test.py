@@ -0,0 +1,38 @@
+#!/usr/bin/python
+#
+# Tests the nice, sched and affinity prefixes
+#
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+#################################################################
+# 
+# Boilerplate ends here, now write your specific test.
+#
+#################################################################
+# Step 1. affinity restricts every stage of the job to the given CPUs
+#
+sendline("affinity 0 grep Cpus_allowed_list /proc/self/status | cat")
+expect(r"Cpus_allowed_list:\t0\r\n", "affinity was not applied")
+expect_prompt("Shell did not print expected prompt after affinity")
+
+#################################################################
+# Step 2. nice adjustments add up, and combine with sched
+#
+sendline('nice 3 nice -n 2 sched batch cut "-d " -f19,41 /proc/self/stat')
+expect_exact("5 3\r\n", "nice or sched was not applied")    # SCHED_BATCH
+expect_prompt("Shell did not print expected prompt after nice")
+
+#################################################################
+# Step 3. A CPU set the system refuses is reported, not fatal
+#
+sendline("affinity 1023 true")
+expect_exact("true: Invalid argument", "refused affinity was not reported")
+expect_prompt("Shell did not print expected prompt after a refused spawn")
+
+test_success()
@@ -0,0 +1,41 @@
+#!/usr/bin/python
+#
+# Tests running a script file (cush script) without an interactive prompt
+#
+import atexit, proc_check, time, pexpect
+import tempfile, os
+from testutils import *
+
+#################################################################
+# Step 1. Write a script with a few commands and a pipeline
+#
+fd, script = tempfile.mkstemp("-cush-script")
+os.write(fd, b"echo first line\n"
+             b"\n"
+             b"echo hello | tr h H\n"
+             b"cd /\n"
+             b"pwd\n"
+             b"echo no final newline")
+os.close(fd)
+
+def cleanup():
+    os.unlink(script)
+
+atexit.register(cleanup)
+
+#################################################################
+# Step 2. Run it: every command runs in order and the shell exits
+#         without ever printing a prompt
+#
+# setup_tests appends the arguments to the shell command without a 
+# separator, hence the leading empty one
+console = setup_tests(["", script])
+
+expect_exact("first line", "script did not run its first command")
+expect_exact("Hello", "script did not run its pipeline")
+expect_exact("/\r\n", "cd in a script did not affect later commands")
+expect_exact("no final newline", "last line without newline was not run")
+assert console.expect([pexpect.EOF, "cush>"]) == 0, \
+    "shell printed a prompt or did not exit at the end of the script"
+
+test_success()
@@ -0,0 +1,115 @@
+#!/usr/bin/python
+#
+# Tests the functionality of the set builtin
+#
+import atexit, proc_check, time, pexpect
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+#################################################################
+# 
+# Boilerplate ends here, now write your specific test.
+#
+#################################################################
+# Step 1. Pipes start out with the kernel's default size
+#
+sendline("set")
+expect_exact("pipesize=0", "set did not list the default pipe size")
+expect_prompt("Shell did not print expected prompt after set")
+
+#################################################################
+# Step 2. set pipesize takes sizes with a unit suffix
+#
+sendline("set pipesize=256K")
+expect_prompt("Shell did not print expected prompt after set pipesize=256K")
+
+sendline("set")
+expect_exact("pipesize=262144", "set pipesize=256K did not take effect")
+expect_prompt("Shell did not print expected prompt after set")
+
+#################################################################
+# Step 3. Pipelines still work with the larger pipes
+#
+sendline("echo hello | tr h H | cat")
+expect_exact("Hello", "pipeline did not work with pipesize set")
+expect_prompt("Shell did not print expected prompt after pipeline")
+
+#################################################################
+# Step 4. Bad sizes and unknown options are reported
+#
+sendline("set pipesize=lots")
+expect_exact("set: pipesize: invalid size lots", 
+             "set did not reject an invalid size")
+expect_prompt("Shell did not print expected prompt after set pipesize=lots")
+
+sendline("set no_such_option=1")
+expect_exact("set: no_such_option: unknown option",
+             "set did not reject an unknown option")
+expect_prompt("Shell did not print expected prompt after set no_such_option=1")
+
+#################################################################
+# Step 5. With jobs_max set, background jobs beyond it wait in a queue
+#
+sendline("set jobs_max=1")
+expect_prompt("Shell did not print expected prompt after set jobs_max=1")
+
+sendline("sleep 30 &")
+(jobid, pid) = parse_bg_status()
+expect_prompt("Shell did not print expected prompt after first job")
+
+sendline("sleep 20 &")
+expect_exact("queued", "second background job was not queued")
+expect_prompt("Shell did not print expected prompt after second job")
+
+sendline("jobs")
+expect("Running\s+\(sleep 30\)", "first job is not running")
+expect("Queued\s+\(sleep 20\)", "second job is not queued")
+expect_prompt("Shell did not print expected prompt after jobs")
+
+#################################################################
+# Step 6. The queued job starts once the running one is gone
+#
+run_builtin('kill', jobid)
+expect_prompt("Shell did not print expected prompt after kill")
+
+sendline("jobs")
+expect("Running\s+\(sleep 20\)", "queued job was not started")
+expect_prompt("Shell did not print expected prompt after jobs")
+
+#################################################################
+# Step 7. Background parallel jobs and pipelines with builtins wait for
+#         a slot as well
+#
+sendline("parallel echo ::: queued_item &")
+expect_exact("queued", "parallel job was not queued")
+expect_prompt("Shell did not print expected prompt after parallel &")
+
+sendline("echo queued_echo | cat &")
+expect_exact("queued", "builtin pipeline was not queued")
+expect_prompt("Shell did not print expected prompt after echo | cat &")
+
+sendline("jobs")
+expect("Queued\s+\(parallel echo ::: queued_item\)", 
+       "parallel job is not queued")
+expect("Queued\s+\(echo queued_echo\| cat\)", 
+       "builtin pipeline is not queued")
+expect_prompt("Shell did not print expected prompt after jobs")
+
+sendline("set jobs_max=many")
+expect_exact("set: jobs_max: invalid number many",
+             "set did not reject an invalid number")
+expect_prompt("Shell did not print expected prompt after set jobs_max=many")
+
+#################################################################
+# Step 8. exit kills the running job without starting the queued ones
+#
+sendline("exit")
+assert console.expect(pexpect.EOF) == 0, "Shell did not exit"
+assert "queued_item" not in console.before, "queued parallel job was started"
+assert "queued_echo" not in console.before, "queued pipeline was started"
+
+test_success()
@@ -0,0 +1,79 @@
+#!/usr/bin/python
+#
+# Tests the timeout prefix and jobs --timeout
+#
+import atexit, os, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+#################################################################
+# 
+# Boilerplate ends here, now write your specific test.
+#
+#################################################################
+# Step 1. A foreground job is terminated when its time is up
+#
+sendline("timeout 0.5 sleep 30")
+expect_exact("Timed out", "foreground job did not time out")
+expect_prompt("Shell did not print expected prompt after timeout")
+
+#################################################################
+# Step 2. jobs --timeout limits a job that is already running
+#
+sendline("sleep 30 &")
+(jobid, pid) = parse_bg_status()
+expect_prompt("Shell did not print expected prompt after starting job")
+
+sendline("jobs --timeout %" + jobid + " 0.5")
+expect_prompt("Shell did not print expected prompt after jobs --timeout")
+time.sleep(1)
+sendline("")
+expect(r"\[" + jobid + r"\]\tTimed out\t\t\(sleep 30\)", 
+       "background job did not time out")
+expect_prompt()
+assert not os.path.exists('/proc/' + pid), "timed out job is still alive"
+
+#################################################################
+# Step 3. A background job times out while a foreground job runs,
+#         even if it is stopped
+#
+sendline("timeout 0.5 sleep 30 &")
+(jobid, pid) = parse_bg_status()
+expect_prompt("Shell did not print expected prompt after starting job")
+run_builtin('stop', jobid)
+expect_prompt()
+
+sendline("sleep 1.5")
+expect(r"\[" + jobid + r"\]\tTimed out\t\t\(sleep 30\)", 
+       "stopped background job did not time out")
+expect_prompt()
+
+#################################################################
+# Step 4. A huge timeout replaces a shorter one instead of being 
+#         ignored, and does not end the job
+#
+sendline("sleep 30 &")
+(jobid, pid) = parse_bg_status()
+expect_prompt("Shell did not print expected prompt after starting job")
+
+sendline("jobs --timeout %" + jobid + " 0.5")
+expect_prompt("Shell did not print expected prompt after jobs --timeout")
+sendline("jobs --timeout %" + jobid + " 1e19")
+expect_prompt("Shell did not print expected prompt after jobs --timeout")
+time.sleep(1)
+sendline("jobs")
+expect(r"\[" + jobid + r"\]\tRunning\t\t\(sleep 30\)", 
+       "job with a huge timeout did not keep running")
+expect_prompt()
+run_builtin('kill', jobid)
+expect_prompt()
+
+sendline("timeout 1e19 echo huge")
+expect_exact("huge", "command with a huge timeout did not run")
+expect_prompt()
+
+test_success()
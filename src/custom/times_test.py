@@ -0,0 +1,48 @@
+#!/usr/bin/python
+#
+# Tests the resource usage shown by jobs -l and the times builtin
+#
+import atexit, proc_check, time
+from testutils import *
+
+console = setup_tests()
+
+# ensure that shell prints expected prompt
+expect_prompt()
+
+#################################################################
+# 
+# Boilerplate ends here, now write your specific test.
+#
+#################################################################
+# Step 1. jobs -l lists every process of a running job
+#
+sendline("sleep 30 | cat &")
+(jobid, pid) = parse_bg_status()
+expect_prompt("Shell did not print expected prompt after starting job")
+
+sendline("jobs -l")
+expect(r"\t" + pid + r"\s+Running\s+-\s+-\s+-\s+[\d.]+r  sleep 30\r\n")
+expect(r"\t\d+\s+Running\s+-\s+-\s+-\s+[\d.]+r  cat\r\n")
+expect(r"\ttotal\s+\(so far\)")
+expect_prompt("Shell did not print expected prompt after jobs -l")
+
+run_builtin('kill', jobid)
+expect_prompt("Shell did not print expected prompt after kill")
+
+#################################################################
+# Step 2. times shows the shell's and its children's CPU time,
+#         and what each stage of the last job used
+#
+sendline("true | false")
+expect_prompt("Shell did not print expected prompt after true | false")
+
+sendline("times")
+expect(r"\d+m[\d.]+s \d+m[\d.]+s\r\n\d+m[\d.]+s \d+m[\d.]+s\r\n")
+expect_exact("last job: (true| false)", "times did not show the last job")
+expect(r"\t\d+\s+Done\s+[\d.]+u\s+[\d.]+s\s+\d+K\s+[\d.]+r  true\r\n")
+expect(r"\t\d+\s+Exit 1\s+[\d.]+u\s+[\d.]+s\s+\d+K\s+[\d.]+r  false\r\n")
+expect(r"\ttotal\s+[\d.]+u\s+[\d.]+s\s+\d+K\s+[\d.]+r\r\n")
+expect_prompt("Shell did not print expected prompt after times")
+
+test_success()
@@ -2,4 +2,12 @@
 1 gback_glob_test.py
 1 custom/cd_test.py
 1 custom/history.py
+1 custom/hash_test.py
+1 custom/script_test.py
+1 custom/builtin_pipe_test.py
+1 custom/set_test.py
+1 custom/times_test.py
+1 custom/parallel_test.py
+1 custom/timeout_test.py
+1 custom/sched_test.py
 
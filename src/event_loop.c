@@ -0,0 +1,124 @@
+/*
+ * A minimal epoll-based event loop for the shell.
+ */
+
+#include <sys/epoll.h>
+#include <stdbool.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <assert.h>
+
+#include "event_loop.h"
+#include "list.h"
+#include "utils.h"
+
+#define MAX_EVENTS 16
+
+struct event_source {
+    int fd;
+    event_handler_t handler;
+    void *data;
+    bool removed;            /* removed while its event was pending */
+    struct list_elem elem;
+};
+
+static int epoll_fd = -1;
+static struct list sources;         /* all registered event sources */
+static struct list removed_sources; /* removed during dispatch, freed after */
+static int dispatch_depth;          /* > 0 while running handlers */
+
+/* Initialize the event loop. */
+void
+event_loop_init(void)
+{
+    assert(epoll_fd == -1 || !!!"event_loop_init already called");
+
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    if (epoll_fd == -1)
+        utils_fatal_error("epoll_create1 failed: ");
+
+    list_init(&sources);
+    list_init(&removed_sources);
+}
+
+static void
+add_source(int fd, uint32_t events, event_handler_t handler, void *data)
+{
+    struct event_source *src = malloc(sizeof *src);
+    src->fd = fd;
+    src->handler = handler;
+    src->data = data;
+    src->removed = false;
+
+    struct epoll_event ev = { .events = events, .data.ptr = src };
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1)
+        utils_fatal_error("epoll_ctl failed to add fd %d: ", fd);
+
+    list_push_back(&sources, &src->elem);
+}
+
+/* Start watching fd for readability. */
+void
+event_loop_add(int fd, event_handler_t handler, void *data)
+{
+    add_source(fd, EPOLLIN, handler, data);
+}
+
+/* Start watching fd for writability. */
+void
+event_loop_add_output(int fd, event_handler_t handler, void *data)
+{
+    add_source(fd, EPOLLOUT, handler, data);
+}
+
+/* Stop watching fd.  Safe to call from within a handler. */
+void
+event_loop_remove(int fd)
+{
+    for (struct list_elem *e = list_begin(&sources); e != list_end(&sources);
+         e = list_next(e)) {
+        struct event_source *src = list_entry(e, struct event_source, elem);
+        if (src->fd != fd)
+            continue;
+
+        if (epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, NULL) == -1)
+            utils_error("epoll_ctl failed to remove fd %d: ", fd);
+
+        list_remove(e);
+        if (dispatch_depth > 0) {
+            /* An event for it may still be in the batch being dispatched */
+            src->removed = true;
+            list_push_back(&removed_sources, &src->elem);
+        } else {
+            free(src);
+        }
+        return;
+    }
+}
+
+/* Wait up to timeout_ms milliseconds (-1: forever) for at least one
+ * watched fd to become ready and run the handlers of all ready fds. */
+void
+event_loop_dispatch(int timeout_ms)
+{
+    struct epoll_event events[MAX_EVENTS];
+
+    int n = epoll_wait(epoll_fd, events, MAX_EVENTS, timeout_ms);
+    if (n == -1) {
+        if (errno != EINTR)
+            utils_fatal_error("epoll_wait failed: ");
+        return;
+    }
+
+    dispatch_depth++;
+    for (int i = 0; i < n; i++) {
+        struct event_source *src = events[i].data.ptr;
+        if (!src->removed)
+            src->handler(src->fd, src->data);
+    }
+    dispatch_depth--;
+
+    while (dispatch_depth == 0 && !list_empty(&removed_sources))
+        free(list_entry(list_pop_front(&removed_sources),
+                        struct event_source, elem));
+}
@@ -0,0 +1,33 @@
+#ifndef __EVENT_LOOP_H
+#define __EVENT_LOOP_H
+
+/* A minimal epoll-based event loop.
+ *
+ * The shell registers every file descriptor it needs to react to
+ * (terminal input, a signalfd for SIGCHLD, timerfds, pipes builtin 
+ * output is still being written to) and handles all of them 
+ * synchronously from event_loop_dispatch(), so nothing interesting 
+ * ever runs in signal handler context.
+ */
+
+/* Called when fd becomes readable (or writable, see 
+ * event_loop_add_output) */
+typedef void (*event_handler_t)(int fd, void *data);
+
+/* Initialize the event loop. */
+void event_loop_init(void);
+
+/* Start watching fd for readability. */
+void event_loop_add(int fd, event_handler_t handler, void *data);
+
+/* Start watching fd for writability. */
+void event_loop_add_output(int fd, event_handler_t handler, void *data);
+
+/* Stop watching fd.  Safe to call from within a handler. */
+void event_loop_remove(int fd);
+
+/* Wait up to timeout_ms milliseconds (-1: forever) for at least one
+ * watched fd to become ready and run the handlers of all ready fds. */
+void event_loop_dispatch(int timeout_ms);
+
+#endif /* __EVENT_LOOP_H */
@@ -0,0 +1,447 @@
+/*
+ * Pathname expansion of command words, with a compiled pattern matcher
+ * and directory listings that are read once per pipeline.
+ */
+
+#define _GNU_SOURCE    1
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "glob_expand.h"
+#include "list.h"
+#include "utils.h"
+
+#define GETDENTS_BUF_SIZE   65536
+
+/* One entry of a directory listing */
+struct dir_entry {
+    const char *name;
+    unsigned char type;          /* d_type, may be DT_UNKNOWN */
+};
+
+/* The names in one directory, except . and .. */
+struct dir_listing {
+    char *path;                  /* as spelled in the pattern, "" for . */
+    char *names;                 /* all names, NUL-separated */
+    struct dir_entry *entries;
+    size_t count;
+    struct list_elem elem;
+};
+
+/* A pattern component compiled into a sequence of operations */
+enum glob_op_kind {
+    OP_END,
+    OP_LITERAL,                  /* the len bytes at lit */
+    OP_ANY,                      /* ? */
+    OP_STAR,                     /* * */
+    OP_CLASS                     /* [...] */
+};
+
+struct glob_op {
+    enum glob_op_kind kind;
+    const char *lit;
+    size_t len;
+    uint8_t set[32];             /* bytes an OP_CLASS matches */
+};
+
+struct glob_state {
+    struct ast_arena *arena;     /* receives the new argv and matches */
+    struct list listings;
+    char **args;                 /* the argv being built */
+    size_t nargs;
+    size_t capacity;
+    char path[PATH_MAX];         /* the path matched so far */
+};
+
+/* Is name "." or ".."? */
+static bool
+is_dot_or_dotdot(const char *name)
+{
+    return name[0] == '.'
+        && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+/* Read the directory path with getdents64.  A directory that cannot be
+ * opened yields an empty listing. */
+static struct dir_listing *
+read_listing(const char *path)
+{
+    struct dir_listing *dir = malloc(sizeof *dir);
+    char *buf = malloc(GETDENTS_BUF_SIZE);
+    if (dir == NULL || buf == NULL || (dir->path = strdup(path)) == NULL)
+        utils_fatal_error("cannot read directory for globbing: ");
+    dir->names = NULL;
+    dir->entries = NULL;
+    dir->count = 0;
+
+    int fd = open(*path ? path : ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd < 0) {
+        free(buf);
+        return dir;
+    }
+
+    /* Names are collected by offset, since dir->names may move */
+    size_t names_len = 0, names_cap = 0, entries_cap = 0;
+    ssize_t n;
+    while ((n = getdents64(fd, buf, GETDENTS_BUF_SIZE)) > 0) {
+        for (ssize_t off = 0; off < n; ) {
+            struct dirent64 *d = (struct dirent64 *) (buf + off);
+            off += d->d_reclen;
+            if (is_dot_or_dotdot(d->d_name))
+                continue;
+
+            size_t len = strlen(d->d_name) + 1;
+            if (names_len + len > names_cap) {
+                names_cap = names_cap ? 2 * names_cap : GETDENTS_BUF_SIZE;
+                dir->names = realloc(dir->names, names_cap);
+            }
+            if (dir->count == entries_cap) {
+                entries_cap = entries_cap ? 2 * entries_cap : 256;
+                dir->entries = realloc(dir->entries,
+                                       entries_cap * sizeof *dir->entries);
+            }
+            if (dir->names == NULL || dir->entries == NULL)
+                utils_fatal_error("cannot read directory for globbing: ");
+
+            memcpy(dir->names + names_len, d->d_name, len);
+            dir->entries[dir->count].name = (char *) (uintptr_t) names_len;
+            dir->entries[dir->count].type = d->d_type;
+            dir->count++;
+            names_len += len;
+        }
+    }
+    close(fd);
+    free(buf);
+
+    for (size_t i = 0; i < dir->count; i++)
+        dir->entries[i].name = dir->names + (uintptr_t) dir->entries[i].name;
+    return dir;
+}
+
+/* Return the listing of directory path, reading it on first use */
+static struct dir_listing *
+get_listing(struct glob_state *st, const char *path)
+{
+    for (struct list_elem *e = list_begin(&st->listings);
+         e != list_end(&st->listings); e = list_next(e)) {
+        struct dir_listing *dir = list_entry(e, struct dir_listing, elem);
+        if (!strcmp(dir->path, path))
+            return dir;
+    }
+    struct dir_listing *dir = read_listing(path);
+    list_push_back(&st->listings, &dir->elem);
+    return dir;
+}
+
+/* Does the component p[0..len) contain a wildcard character? */
+static bool
+has_wildcards(const char *p, size_t len)
+{
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == '\\')
+            i++;
+        else if (p[i] == '*' || p[i] == '?' || p[i] == '[')
+            return true;
+    }
+    return false;
+}
+
+/* Copy the component p[0..len) to dst without its backslashes, return
+ * the length of the copy */
+static size_t
+copy_literal(char *dst, const char *p, size_t len)
+{
+    size_t n = 0;
+    for (size_t i = 0; i < len; i++) {
+        if (p[i] == '\\' && i + 1 < len)
+            i++;
+        dst[n++] = p[i];
+    }
+    return n;
+}
+
+/* Compile the bracket expression starting at p into set.  Returns a
+ * pointer past its closing ], or NULL if there is none, in which case
+ * the [ stands for itself. */
+static const char *
+compile_class(const char *p, const char *end, uint8_t set[32])
+{
+    const char *q = p + 1;
+    bool negate = q < end && (*q == '!' || *q == '^');
+    if (negate)
+        q++;
+
+    memset(set, 0, 32);
+    for (bool first = true; q < end && (*q != ']' || first); first = false) {
+        unsigned char lo = *q++;
+        if (lo == '\\' && q < end)
+            lo = *q++;
+        unsigned char hi = lo;
+        if (q + 1 < end && *q == '-' && q[1] != ']') {
+            hi = q[1];
+            q += 2;
+            if (hi == '\\' && q < end)
+                hi = *q++;
+        }
+        for (unsigned c = lo; c <= hi; c++)
+            set[c / 8] |= 1 << (c % 8);
+    }
+    if (q >= end)
+        return NULL;
+
+    if (negate) {
+        for (int i = 0; i < 32; i++)
+            set[i] = ~set[i];
+    }
+    return q + 1;
+}
+
+/* Compile the component p[0..len) into ops, which must have room for
+ * len + 1 operations.  Literal text is unescaped into lits. */
+static void
+compile_pattern(const char *p, size_t len, struct glob_op *ops, char *lits)
+{
+    const char *end = p + len;
+    struct glob_op *op = ops;
+    while (p < end) {
+        const char *next;
+        if (*p == '*') {
+            if (op == ops || op[-1].kind != OP_STAR)
+                (op++)->kind = OP_STAR;
+            p++;
+        } else if (*p == '?') {
+            (op++)->kind = OP_ANY;
+            p++;
+        } else if (*p == '[' && (next = compile_class(p, end, op->set))) {
+            (op++)->kind = OP_CLASS;
+            p = next;
+        } else {
+            char c = *p++;
+            if (c == '\\' && p < end)
+                c = *p++;
+            /* Adjacent literal bytes form one operation */
+            if (op > ops && op[-1].kind == OP_LITERAL) {
+                op[-1].len++;
+            } else {
+                op->kind = OP_LITERAL;
+                op->lit = lits;
+                op->len = 1;
+                op++;
+            }
+            *lits++ = c;
+        }
+    }
+    op->kind = OP_END;
+}
+
+/* Does name match the compiled pattern?  On a mismatch, the most recent
+ * * swallows one more byte and matching resumes after it; earlier stars
+ * never need to be revisited. */
+static bool
+match(const struct glob_op *ops, const char *name)
+{
+    const struct glob_op *op = ops, *star_op = NULL;
+    const char *s = name, *star_s = NULL;
+
+    for (;;) {
+        switch (op->kind) {
+        case OP_END:
+            if (*s == '\0')
+                return true;
+            break;
+        case OP_STAR:
+            star_op = ++op;
+            star_s = s;
+            continue;
+        case OP_LITERAL:
+            if (!strncmp(s, op->lit, op->len)) {
+                s += op->len;
+                op++;
+                continue;
+            }
+            break;
+        case OP_ANY:
+            if (*s != '\0') {
+                s++;
+                op++;
+                continue;
+            }
+            break;
+        case OP_CLASS: {
+            unsigned char c = *s;
+            if (c != '\0' && (op->set[c / 8] & (1 << (c % 8)))) {
+                s++;
+                op++;
+                continue;
+            }
+            break;
+        }
+        }
+
+        if (star_op == NULL || *star_s == '\0')
+            return false;
+        op = star_op;
+        s = ++star_s;
+    }
+}
+
+/* Append arg to the argv being built */
+static void
+add_arg(struct glob_state *st, char *arg)
+{
+    if (st->nargs == st->capacity) {
+        st->capacity = st->capacity ? 2 * st->capacity : 64;
+        st->args = realloc(st->args, st->capacity * sizeof *st->args);
+        if (st->args == NULL)
+            utils_fatal_error("cannot expand glob pattern: ");
+    }
+    st->args[st->nargs++] = arg;
+}
+
+/* Is the entry st->path[0..len), found as e in a listing, a directory? */
+static bool
+is_directory(struct glob_state *st, size_t len, const struct dir_entry *e)
+{
+    if (e->type == DT_DIR)
+        return true;
+    if (e->type != DT_LNK && e->type != DT_UNKNOWN)
+        return false;
+
+    struct stat sb;
+    st->path[len] = '\0';
+    return stat(st->path, &sb) == 0 && S_ISDIR(sb.st_mode);
+}
+
+/* Match the rest of a pattern below st->path[0..len), adding each
+ * complete match to the argv being built */
+static void
+expand(struct glob_state *st, size_t len, const char *pattern)
+{
+    while (*pattern == '/') {
+        if (len + 1 >= PATH_MAX)
+            return;
+        st->path[len++] = '/';
+        pattern++;
+    }
+    if (*pattern == '\0') {
+        add_arg(st, ast_arena_strndup(st->arena, st->path, len));
+        return;
+    }
+
+    const char *end = strchrnul(pattern, '/');
+    size_t complen = end - pattern;
+    bool last = *end == '\0';
+    if (len + complen >= PATH_MAX)
+        return;
+
+    /* A component without wildcards names just one entry */
+    if (!has_wildcards(pattern, complen)) {
+        len += copy_literal(st->path + len, pattern, complen);
+        st->path[len] = '\0';
+        struct stat sb;
+        if (!last)
+            expand(st, len, end);
+        else if (lstat(st->path, &sb) == 0)
+            add_arg(st, ast_arena_strndup(st->arena, st->path, len));
+        return;
+    }
+
+    st->path[len] = '\0';
+    struct dir_listing *dir = get_listing(st, st->path);
+
+    struct glob_op ops[complen + 1];
+    char lits[complen];
+    compile_pattern(pattern, complen, ops, lits);
+    bool dot_ok = ops[0].kind == OP_LITERAL && ops[0].lit[0] == '.';
+
+    for (size_t i = 0; i < dir->count; i++) {
+        const struct dir_entry *e = &dir->entries[i];
+        if ((e->name[0] == '.' && !dot_ok) || !match(ops, e->name))
+            continue;
+
+        size_t namelen = strlen(e->name);
+        if (len + namelen >= PATH_MAX)
+            continue;
+        memcpy(st->path + len, e->name, namelen);
+        if (last)
+            add_arg(st, ast_arena_strndup(st->arena, st->path, len + namelen));
+        else if (is_directory(st, len + namelen, e))
+            expand(st, len + namelen, end);
+    }
+}
+
+static int
+compare_args(const void *a, const void *b)
+{
+    return strcmp(*(char * const *) a, *(char * const *) b);
+}
+
+/* Replace cmd's argv with its expansion */
+static void
+expand_command(struct glob_state *st, struct ast_command *cmd)
+{
+    st->nargs = 0;
+    for (int i = 0; cmd->argv[i] != NULL; i++) {
+        if (!cmd->glob_words[i]) {
+            add_arg(st, cmd->argv[i]);
+            continue;
+        }
+
+        size_t first = st->nargs;
+        expand(st, 0, cmd->argv[i]);
+        if (st->nargs == first)
+            add_arg(st, cmd->argv[i]);
+        else
+            qsort(st->args + first, st->nargs - first, sizeof *st->args,
+                  compare_args);
+    }
+
+    char **argv = ast_arena_alloc(st->arena, (st->nargs + 1) * sizeof *argv);
+    memcpy(argv, st->args, st->nargs * sizeof *argv);
+    argv[st->nargs] = NULL;
+    cmd->argv = argv;
+    cmd->glob_words = NULL;
+}
+
+/* Expand the marked words of all commands in pipe */
+void
+glob_expand_pipeline(struct ast_pipeline *pipe)
+{
+    struct glob_state *st = NULL;
+    for (struct list_elem *e = list_begin(&pipe->commands);
+         e != list_end(&pipe->commands); e = list_next(e)) {
+        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
+        if (cmd->glob_words == NULL)
+            continue;
+
+        if (st == NULL) {
+            st = malloc(sizeof *st);
+            if (st == NULL)
+                utils_fatal_error("cannot expand glob pattern: ");
+            st->arena = pipe->arena;
+            list_init(&st->listings);
+            st->args = NULL;
+            st->capacity = 0;
+        }
+        expand_command(st, cmd);
+    }
+    if (st == NULL)
+        return;
+
+    while (!list_empty(&st->listings)) {
+        struct dir_listing *dir = list_entry(list_pop_front(&st->listings),
+                                             struct dir_listing, elem);
+        free(dir->path);
+        free(dir->names);
+        free(dir->entries);
+        free(dir);
+    }
+    free(st->args);
+    free(st);
+}
@@ -0,0 +1,24 @@
+#ifndef __GLOB_EXPAND_H
+#define __GLOB_EXPAND_H
+
+#include "shell-ast.h"
+
+/* Pathname expansion ("globbing") of command words.
+ *
+ * Unquoted words containing *, ? or [ are marked by the parser in
+ * ast_command->glob_words.  Before a pipeline runs, each marked word is
+ * replaced by the sorted list of existing paths it matches, or left
+ * alone if it matches none.  A name starting with a dot is only matched
+ * by a pattern whose component starts with a literal dot.
+ *
+ * Every directory a pipeline's patterns need is read once, with
+ * getdents64, and its listing is shared by all of them.  Each path
+ * component is compiled into a small matcher before it is run against
+ * the listing.
+ */
+
+/* Expand the marked words of all commands in pipe.  The new argv arrays
+ * and matched paths are allocated from pipe's arena. */
+void glob_expand_pipeline(struct ast_pipeline *pipe);
+
+#endif /* __GLOB_EXPAND_H */
@@ -0,0 +1,146 @@
+/*
+ * Job id allocation for the shell's job table.
+ */
+
+#include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "jid_table.h"
+#include "utils.h"
+
+#define BITS 64
+#define JID_TABLE_MIN_CAPACITY BITS
+
+/* Number of 64-bit words needed to hold n bits */
+static int
+words_for(int n)
+{
+    return (n + BITS - 1) / BITS;
+}
+
+/* realloc that zeroes the new tail and dies on failure */
+static void *
+grow_array(void *p, size_t old_size, size_t new_size)
+{
+    char *q = realloc(p, new_size);
+    if (q == NULL)
+        utils_fatal_error("cannot grow job table: ");
+    memset(q + old_size, 0, new_size - old_size);
+    return q;
+}
+
+/* Double the number of ids backed by storage, up to the limit.
+ * Returns false if the table is already at its limit. */
+static bool
+grow(struct jid_table *table)
+{
+    int old_capacity = table->capacity;
+    if (old_capacity >= table->limit)
+        return false;
+
+    int new_capacity = old_capacity ? old_capacity * 2 : JID_TABLE_MIN_CAPACITY;
+    if (new_capacity > table->limit)
+        new_capacity = table->limit;
+
+    table->slots = grow_array(table->slots,
+                              old_capacity * sizeof *table->slots,
+                              new_capacity * sizeof *table->slots);
+    table->used = grow_array(table->used,
+                             words_for(old_capacity) * sizeof *table->used,
+                             words_for(new_capacity) * sizeof *table->used);
+    table->full = grow_array(table->full,
+                             words_for(words_for(old_capacity)) * sizeof *table->full,
+                             words_for(words_for(new_capacity)) * sizeof *table->full);
+    table->capacity = new_capacity;
+    return true;
+}
+
+/* Mark jid as allocated or free, keeping the summary bits in sync */
+static void
+set_used(struct jid_table *table, int jid, bool used)
+{
+    int w = jid / BITS;
+    if (used) {
+        table->used[w] |= 1ULL << (jid % BITS);
+        if (table->used[w] == ~0ULL)
+            table->full[w / BITS] |= 1ULL << (w % BITS);
+    } else {
+        table->used[w] &= ~(1ULL << (jid % BITS));
+        table->full[w / BITS] &= ~(1ULL << (w % BITS));
+    }
+}
+
+/* Initialize an empty table handing out ids in [1, limit) */
+void
+jid_table_init(struct jid_table *table, int limit)
+{
+    assert(limit > 1);
+    table->slots = NULL;
+    table->used = NULL;
+    table->full = NULL;
+    table->capacity = 0;
+    table->limit = limit;
+}
+
+/* Return the lowest id in [0, capacity) that is not in use, or -1 */
+static int
+find_first_free(struct jid_table *table)
+{
+    int nwords = words_for(table->capacity);
+    for (int s = 0; s < words_for(nwords); s++) {
+        uint64_t not_full = ~table->full[s];
+        if (not_full == 0)
+            continue;
+
+        int w = s * BITS + __builtin_ctzll(not_full);
+        if (w >= nwords)
+            return -1;
+
+        int jid = w * BITS + __builtin_ctzll(~table->used[w]);
+        return jid < table->capacity ? jid : -1;
+    }
+    return -1;
+}
+
+/* Allocate the lowest free id and map it to value.
+ * Returns the id, or -1 if all ids below the limit are in use. */
+int
+jid_table_alloc(struct jid_table *table, void *value)
+{
+    if (table->capacity == 0) {
+        grow(table);
+        set_used(table, 0, true);       /* 0 is not a valid job id */
+    }
+
+    int jid;
+    while ((jid = find_first_free(table)) == -1) {
+        if (!grow(table))
+            return -1;
+    }
+
+    set_used(table, jid, true);
+    table->slots[jid] = value;
+    return jid;
+}
+
+/* Release an id returned by jid_table_alloc */
+void
+jid_table_free(struct jid_table *table, int jid)
+{
+    assert(jid > 0 && jid < table->capacity);
+    assert(table->used[jid / BITS] & (1ULL << (jid % BITS)));
+    table->slots[jid] = NULL;
+    set_used(table, jid, false);
+}
+
+/* Return the value mapped to jid, or NULL if jid is not allocated */
+void *
+jid_table_get(struct jid_table *table, int jid)
+{
+    if (jid <= 0 || jid >= table->capacity)
+        return NULL;
+
+    return table->slots[jid];
+}
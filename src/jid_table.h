@@ -0,0 +1,36 @@
+#ifndef __JID_TABLE_H
+#define __JID_TABLE_H
+
+#include <stdint.h>
+
+/* A table of job ids.
+ *
+ * Hands out the lowest free job id in constant time using a two-level
+ * bitmap (one bit per id, plus one bit per bitmap word that is full),
+ * and maps each allocated id to a pointer.  Storage grows with the
+ * highest id in use rather than with the maximum number of jobs, so
+ * an idle shell does not pay for a table sized for the worst case.
+ * Id 0 is never handed out.
+ */
+struct jid_table {
+    void **slots;            /* slots[jid] is the value for jid */
+    uint64_t *used;          /* bit jid is set if jid is allocated */
+    uint64_t *full;          /* bit w is set if used[w] is all ones */
+    int capacity;            /* ids [0, capacity) are backed by storage */
+    int limit;               /* ids are always < limit */
+};
+
+/* Initialize an empty table handing out ids in [1, limit) */
+void jid_table_init(struct jid_table *table, int limit);
+
+/* Allocate the lowest free id and map it to value.
+ * Returns the id, or -1 if all ids below the limit are in use. */
+int jid_table_alloc(struct jid_table *table, void *value);
+
+/* Release an id returned by jid_table_alloc */
+void jid_table_free(struct jid_table *table, int jid);
+
+/* Return the value mapped to jid, or NULL if jid is not allocated */
+void *jid_table_get(struct jid_table *table, int jid);
+
+#endif /* __JID_TABLE_H */
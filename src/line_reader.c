@@ -0,0 +1,104 @@
+/*
+ * A buffered line reader for running scripts.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "line_reader.h"
+#include "utils.h"
+
+#define LINE_READER_CHUNK (256 * 1024)
+
+/* Read lines from fd */
+void
+line_reader_init_fd(struct line_reader *reader, int fd)
+{
+    reader->fd = fd;
+    reader->size = LINE_READER_CHUNK;
+    reader->buf = malloc(reader->size);
+    if (reader->buf == NULL)
+        utils_fatal_error("cannot allocate input buffer: ");
+    reader->start = reader->end = 0;
+    reader->eof = false;
+}
+
+/* Read lines from a copy of string */
+void
+line_reader_init_string(struct line_reader *reader, const char *string)
+{
+    reader->fd = -1;
+    reader->end = strlen(string);
+    reader->size = reader->end + 1;
+    reader->buf = malloc(reader->size);
+    if (reader->buf == NULL)
+        utils_fatal_error("cannot allocate input buffer: ");
+    memcpy(reader->buf, string, reader->size);
+    reader->start = 0;
+    reader->eof = true;
+}
+
+/* Make room for at least one more chunk after the unconsumed data */
+static void
+make_room(struct line_reader *reader)
+{
+    memmove(reader->buf, reader->buf + reader->start,
+            reader->end - reader->start);
+    reader->end -= reader->start;
+    reader->start = 0;
+
+    /* A line longer than the buffer: grow it */
+    if (reader->size - reader->end < LINE_READER_CHUNK / 2) {
+        reader->size *= 2;
+        reader->buf = realloc(reader->buf, reader->size);
+        if (reader->buf == NULL)
+            utils_fatal_error("cannot grow input buffer: ");
+    }
+}
+
+/* Return the next line without its newline, or NULL at end of input */
+char *
+line_reader_next(struct line_reader *reader)
+{
+    for (;;) {
+        char *line = reader->buf + reader->start;
+        char *nl = memchr(line, '\n', reader->end - reader->start);
+        if (nl != NULL) {
+            *nl = '\0';
+            reader->start = nl + 1 - reader->buf;
+            return line;
+        }
+
+        if (reader->eof) {
+            if (reader->start == reader->end)
+                return NULL;
+            /* Last line without a newline; size always leaves room */
+            reader->buf[reader->end] = '\0';
+            reader->start = reader->end;
+            return line;
+        }
+
+        make_room(reader);
+        /* Keep one byte free for the NUL of an unterminated last line */
+        ssize_t n = read(reader->fd, reader->buf + reader->end,
+                         reader->size - reader->end - 1);
+        if (n > 0)
+            reader->end += n;
+        else if (n == 0)
+            reader->eof = true;
+        else if (errno != EINTR) {
+            utils_error("error reading input: ");
+            reader->eof = true;
+        }
+    }
+}
+
+/* Release the reader's buffer */
+void
+line_reader_destroy(struct line_reader *reader)
+{
+    free(reader->buf);
+    reader->buf = NULL;
+}
@@ -0,0 +1,36 @@
+#ifndef __LINE_READER_H
+#define __LINE_READER_H
+
+#include <stddef.h>
+#include <stdbool.h>
+
+/* A buffered reader that splits its input into lines.
+ *
+ * Used to run scripts without going through readline.  Input is read
+ * in large chunks, and lines are handed out in place (the newline is
+ * overwritten with a NUL), so reading a line costs no copy and, on
+ * average, far less than one read() call.
+ */
+struct line_reader {
+    int fd;                  /* -1 when reading from a string */
+    char *buf;
+    size_t size;             /* capacity of buf */
+    size_t start;            /* first byte not yet handed out */
+    size_t end;              /* end of the data read so far */
+    bool eof;
+};
+
+/* Read lines from fd */
+void line_reader_init_fd(struct line_reader *reader, int fd);
+
+/* Read lines from a copy of string */
+void line_reader_init_string(struct line_reader *reader, const char *string);
+
+/* Return the next line without its newline, or NULL at end of input.
+ * The line stays valid until the next call. */
+char *line_reader_next(struct line_reader *reader);
+
+/* Release the reader's buffer.  Does not close its fd. */
+void line_reader_destroy(struct line_reader *reader);
+
+#endif /* __LINE_READER_H */
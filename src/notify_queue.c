@@ -0,0 +1,96 @@
+/*
+ * A ring buffer of job notifications, flushed in one write before
+ * the prompt.
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/uio.h>
+
+#include "notify_queue.h"
+
+#define MASK (NOTIFY_QUEUE_SIZE - 1)
+
+/* Initialize an empty queue */
+void
+notify_queue_init(struct notify_queue *queue)
+{
+    queue->head = 0;
+    queue->count = 0;
+    queue->dropped = 0;
+}
+
+/* Append msg, dropping the oldest message if the ring is full */
+void
+notify_queue_push(struct notify_queue *queue, char *msg)
+{
+    if (queue->count == NOTIFY_QUEUE_SIZE) {
+        free(queue->msgs[queue->head]);
+        queue->head = (queue->head + 1) & MASK;
+        queue->count--;
+        queue->dropped++;
+    }
+    queue->msgs[(queue->head + queue->count) & MASK] = msg;
+    queue->count++;
+}
+
+/* Write iov[0..iovcnt) to fd, resuming after short writes */
+static void
+writev_all(int fd, struct iovec *iov, int iovcnt)
+{
+    while (iovcnt > 0) {
+        ssize_t n = writev(fd, iov, iovcnt);
+        if (n < 0) {
+            if (errno == EINTR)
+                continue;
+            return;
+        }
+        while (iovcnt > 0 && (size_t) n >= iov->iov_len) {
+            n -= iov->iov_len;
+            iov++;
+            iovcnt--;
+        }
+        if (iovcnt > 0) {
+            iov->iov_base = (char *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
+
+/* Write all queued messages to fd and empty the queue */
+void
+notify_queue_flush(struct notify_queue *queue, int fd)
+{
+    if (queue->count == 0)
+        return;
+
+    struct iovec iov[NOTIFY_QUEUE_SIZE + 1];
+    int iovcnt = 0;
+
+    char note[64];
+    if (queue->dropped > 0) {
+        int len = snprintf(note, sizeof note,
+                           "(%lu job notifications dropped)\n",
+                           queue->dropped);
+        iov[iovcnt].iov_base = note;
+        iov[iovcnt].iov_len = len;
+        iovcnt++;
+    }
+
+    for (unsigned i = 0; i < queue->count; i++) {
+        char *msg = queue->msgs[(queue->head + i) & MASK];
+        iov[iovcnt].iov_base = msg;
+        iov[iovcnt].iov_len = strlen(msg);
+        iovcnt++;
+    }
+
+    writev_all(fd, iov, iovcnt);
+
+    for (unsigned i = 0; i < queue->count; i++)
+        free(queue->msgs[(queue->head + i) & MASK]);
+    queue->head = 0;
+    queue->count = 0;
+    queue->dropped = 0;
+}
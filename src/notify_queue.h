@@ -0,0 +1,34 @@
+#ifndef __NOTIFY_QUEUE_H
+#define __NOTIFY_QUEUE_H
+
+#include <stddef.h>
+
+/* A queue of pending job notifications.
+ *
+ * Reports about jobs that finished, stopped, or were killed are not
+ * printed when the SIGCHLD is handled, which may be while the user is
+ * typing.  They are queued here instead and written out together, in a
+ * single writev, right before the shell prints its next prompt.  The
+ * queue is a ring of NOTIFY_QUEUE_SIZE messages; if more pile up, the
+ * oldest ones are dropped and the flush says how many were lost.
+ */
+#define NOTIFY_QUEUE_SIZE     64        /* must be a power of two */
+
+struct notify_queue {
+    char *msgs[NOTIFY_QUEUE_SIZE];
+    unsigned head;                      /* index of the oldest message */
+    unsigned count;
+    unsigned long dropped;              /* messages lost since last flush */
+};
+
+/* Initialize an empty queue */
+void notify_queue_init(struct notify_queue *queue);
+
+/* Append msg, a heap-allocated string, taking ownership of it */
+void notify_queue_push(struct notify_queue *queue, char *msg);
+
+/* Write all queued messages to fd with a single writev and empty
+ * the queue.  Does nothing if the queue is empty. */
+void notify_queue_flush(struct notify_queue *queue, int fd);
+
+#endif /* __NOTIFY_QUEUE_H */
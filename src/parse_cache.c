@@ -0,0 +1,112 @@
+/*
+ * An LRU cache of parsed command lines, so that lines a user or script
+ * runs over and over are lexed and parsed only once.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "parse_cache.h"
+#include "utils.h"
+
+/* FNV-1a, as in cmd_table */
+static uint32_t
+line_hash(const char *line)
+{
+    uint32_t h = 2166136261u;
+    for (const unsigned char *p = (const unsigned char *) line; *p; p++)
+        h = (h ^ *p) * 16777619u;
+    return h;
+}
+
+/* Initialize an empty cache */
+void
+parse_cache_init(struct parse_cache *cache)
+{
+    for (int i = 0; i < PARSE_CACHE_BUCKETS; i++)
+        list_init(&cache->buckets[i]);
+    list_init(&cache->lru);
+    cache->count = 0;
+    cache->hits = 0;
+    cache->misses = 0;
+}
+
+static void
+remove_entry(struct parse_cache *cache, struct parse_cache_entry *entry)
+{
+    list_remove(&entry->bucket_elem);
+    list_remove(&entry->lru_elem);
+    ast_command_line_free(entry->cmdline);
+    free(entry->line);
+    free(entry);
+    cache->count--;
+}
+
+/* Return the entry for line, or NULL */
+static struct parse_cache_entry *
+find_entry(struct parse_cache *cache, const char *line, uint32_t hash)
+{
+    struct list *bucket = &cache->buckets[hash & (PARSE_CACHE_BUCKETS - 1)];
+    for (struct list_elem *e = list_begin(bucket); e != list_end(bucket);
+         e = list_next(e)) {
+        struct parse_cache_entry *entry;
+        entry = list_entry(e, struct parse_cache_entry, bucket_elem);
+        if (entry->hash == hash && !strcmp(entry->line, line))
+            return entry;
+    }
+    return NULL;
+}
+
+/* Return a command line for line, parsing it on a miss */
+struct ast_command_line *
+parse_cache_parse(struct parse_cache *cache, char *line)
+{
+    uint32_t hash = line_hash(line);
+    struct parse_cache_entry *entry = find_entry(cache, line, hash);
+    if (entry != NULL) {
+        cache->hits++;
+        list_remove(&entry->lru_elem);
+        list_push_front(&cache->lru, &entry->lru_elem);
+        return ast_command_line_clone(entry->cmdline);
+    }
+
+    cache->misses++;
+    struct ast_command_line *cmdline = ast_parse_command_line(line);
+    if (cmdline == NULL)
+        return NULL;
+
+    if (cache->count == PARSE_CACHE_SIZE) {
+        struct parse_cache_entry *victim = list_entry(list_back(&cache->lru),
+                                                      struct parse_cache_entry,
+                                                      lru_elem);
+        remove_entry(cache, victim);
+    }
+
+    entry = malloc(sizeof *entry);
+    if (entry == NULL || (entry->line = strdup(line)) == NULL)
+        utils_fatal_error("cannot add to parse cache: ");
+    entry->hash = hash;
+    entry->cmdline = cmdline;
+    list_push_front(&cache->buckets[hash & (PARSE_CACHE_BUCKETS - 1)],
+                    &entry->bucket_elem);
+    list_push_front(&cache->lru, &entry->lru_elem);
+    cache->count++;
+    return ast_command_line_clone(cmdline);
+}
+
+/* Drop all cached command lines */
+void
+parse_cache_clear(struct parse_cache *cache)
+{
+    while (!list_empty(&cache->lru))
+        remove_entry(cache, list_entry(list_front(&cache->lru),
+                                       struct parse_cache_entry, lru_elem));
+}
+
+/* Print the hit and miss counts to out */
+void
+parse_cache_print(struct parse_cache *cache, FILE *out)
+{
+    fprintf(out, "parse cache: %zu lines, %lu hits, %lu misses\n",
+            cache->count, cache->hits, cache->misses);
+}
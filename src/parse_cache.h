@@ -0,0 +1,53 @@
+#ifndef __PARSE_CACHE_H
+#define __PARSE_CACHE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "list.h"
+#include "shell-ast.h"
+
+/* A cache of parsed command lines.
+ *
+ * Maps the text of a command line, after history expansion, to the
+ * ast_command_line the parser built for it.  The cached trees are never
+ * handed out or modified; callers receive a clone made with
+ * ast_command_line_clone, which copies only the nodes and shares the
+ * words.  Once the cache is full, the least recently used line is
+ * evicted.  Lines that fail to parse are not cached.
+ */
+#define PARSE_CACHE_SIZE      64
+#define PARSE_CACHE_BUCKETS   128       /* must be a power of two */
+
+struct parse_cache_entry {
+    char *line;
+    uint32_t hash;
+    struct ast_command_line *cmdline;   /* the cached tree */
+    struct list_elem bucket_elem;
+    struct list_elem lru_elem;
+};
+
+struct parse_cache {
+    struct list buckets[PARSE_CACHE_BUCKETS];
+    struct list lru;                    /* most recently used first */
+    size_t count;
+    unsigned long hits;
+    unsigned long misses;
+};
+
+/* Initialize an empty cache */
+void parse_cache_init(struct parse_cache *cache);
+
+/* Return a command line for line, parsing it on a miss.  The caller 
+ * owns the result and frees it with ast_command_line_free.  Returns 
+ * NULL if line does not parse. */
+struct ast_command_line *parse_cache_parse(struct parse_cache *cache, 
+                                           char *line);
+
+/* Drop all cached command lines */
+void parse_cache_clear(struct parse_cache *cache);
+
+/* Print the hit and miss counts to out */
+void parse_cache_print(struct parse_cache *cache, FILE *out);
+
+#endif /* __PARSE_CACHE_H */
@@ -0,0 +1,122 @@
+/*
+ * A pid-indexed hash table used to find the process (and job)
+ * a child status change belongs to in constant time.
+ */
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <assert.h>
+
+#include "pid_table.h"
+#include "utils.h"
+
+#define PID_TABLE_MIN_CAPACITY 64
+
+/* Fibonacci hashing: consecutive pids are spread across the table by
+ * taking the top log2(capacity) bits of pid * 2^64 / phi */
+static size_t
+pid_hash(pid_t pid, size_t capacity)
+{
+    int bits = __builtin_ctzl(capacity);
+    return (size_t) (((uint64_t) pid * 11400714819323198485ull) 
+                     >> (64 - bits));
+}
+
+/* Initialize an empty table */
+void
+pid_table_init(struct pid_table *table)
+{
+    table->slots = NULL;
+    table->capacity = 0;
+    table->count = 0;
+}
+
+/* Return the slot holding pid, or the empty slot where it would go */
+static struct pid_table_entry *
+find_slot(struct pid_table *table, pid_t pid)
+{
+    size_t mask = table->capacity - 1;
+    size_t i = pid_hash(pid, table->capacity);
+    while (table->slots[i].pid != 0 && table->slots[i].pid != pid)
+        i = (i + 1) & mask;
+    return &table->slots[i];
+}
+
+/* Double the capacity (or allocate the initial slots) and rehash */
+static void
+grow(struct pid_table *table)
+{
+    struct pid_table_entry *old = table->slots;
+    size_t old_capacity = table->capacity;
+
+    table->capacity = old_capacity ? old_capacity * 2 : PID_TABLE_MIN_CAPACITY;
+    table->slots = calloc(table->capacity, sizeof *table->slots);
+    if (table->slots == NULL)
+        utils_fatal_error("cannot grow pid table: ");
+
+    for (size_t i = 0; i < old_capacity; i++) {
+        if (old[i].pid != 0)
+            *find_slot(table, old[i].pid) = old[i];
+    }
+    free(old);
+}
+
+/* Map pid to value, replacing any previous mapping */
+void
+pid_table_insert(struct pid_table *table, pid_t pid, void *value)
+{
+    assert(pid > 0);
+
+    /* Keep the load factor at or below 1/2 */
+    if (2 * (table->count + 1) > table->capacity)
+        grow(table);
+
+    struct pid_table_entry *slot = find_slot(table, pid);
+    if (slot->pid == 0) {
+        slot->pid = pid;
+        table->count++;
+    }
+    slot->value = value;
+}
+
+/* Return the value mapped to pid, or NULL */
+void *
+pid_table_lookup(struct pid_table *table, pid_t pid)
+{
+    if (table->count == 0)
+        return NULL;
+
+    return find_slot(table, pid)->value;
+}
+
+/* Remove pid from the table.  Returns the value it was mapped to, or NULL */
+void *
+pid_table_remove(struct pid_table *table, pid_t pid)
+{
+    if (table->count == 0)
+        return NULL;
+
+    size_t mask = table->capacity - 1;
+    struct pid_table_entry *slot = find_slot(table, pid);
+    if (slot->pid == 0)
+        return NULL;
+
+    void *value = slot->value;
+    table->count--;
+
+    /* Backward-shift deletion: move any entry in the rest of this probe
+     * run into the hole if the hole lies between its home slot and
+     * where it currently sits. */
+    size_t hole = slot - table->slots;
+    for (size_t i = (hole + 1) & mask; table->slots[i].pid != 0;
+         i = (i + 1) & mask) {
+        size_t home = pid_hash(table->slots[i].pid, table->capacity);
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->slots[hole] = table->slots[i];
+            hole = i;
+        }
+    }
+    table->slots[hole].pid = 0;
+    table->slots[hole].value = NULL;
+    return value;
+}
@@ -0,0 +1,38 @@
+#ifndef __PID_TABLE_H
+#define __PID_TABLE_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/* A hash table mapping pids to arbitrary pointers.
+ *
+ * Open addressing with linear probing.  Deletion shifts later
+ * entries of the same probe run back, so there are no tombstones
+ * and lookups stay short no matter how much churn the table sees.
+ * Lookup and removal never allocate, which makes it safe to call
+ * them while handling a child status change.
+ */
+struct pid_table_entry {
+    pid_t pid;               /* 0 marks an empty slot */
+    void *value;
+};
+
+struct pid_table {
+    struct pid_table_entry *slots;
+    size_t capacity;         /* always 0 or a power of two */
+    size_t count;
+};
+
+/* Initialize an empty table */
+void pid_table_init(struct pid_table *table);
+
+/* Map pid to value, replacing any previous mapping */
+void pid_table_insert(struct pid_table *table, pid_t pid, void *value);
+
+/* Return the value mapped to pid, or NULL */
+void *pid_table_lookup(struct pid_table *table, pid_t pid);
+
+/* Remove pid from the table.  Returns the value it was mapped to, or NULL */
+void *pid_table_remove(struct pid_table *table, pid_t pid);
+
+#endif /* __PID_TABLE_H */
@@ -10,32 +10,143 @@
 #include <sys/types.h>
 #include <limits.h>
 #include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
 
 #include "shell-ast.h"
 
-/* Create new command structure.  Takes ownership of argv. */
+/* Arena chunks past the first one.  The first chunk is allocated together
+ * with the arena itself. */
+struct ast_arena_chunk {
+    struct ast_arena_chunk *next;
+    max_align_t data[];
+};
+
+struct ast_arena {
+    struct ast_arena_chunk *chunks;  /* additional chunks */
+    char *next;                      /* next free byte in current chunk */
+    char *limit;                     /* end of current chunk */
+    size_t chunk_size;               /* size of the next chunk to add */
+    int refcount;
+    struct ast_arena *parent;        /* arena this one's words live in */
+    max_align_t data[];              /* the first chunk */
+};
+
+#define ARENA_ALIGN     _Alignof(max_align_t)
+#define ARENA_MIN_SIZE  1024
+
+/* Create an arena whose first chunk holds size bytes */
+static struct ast_arena *
+arena_create_sized(size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    struct ast_arena *arena = malloc(sizeof *arena + size);
+    if (arena == NULL)
+        return NULL;
+
+    arena->chunks = NULL;
+    arena->next = (char *) arena->data;
+    arena->limit = arena->next + size;
+    arena->chunk_size = 2 * size;
+    arena->refcount = 1;
+    arena->parent = NULL;
+    return arena;
+}
+
+/* Create an arena, sized for a command line of about size_hint bytes.
+ * Each word costs its length plus a little bookkeeping, so four times 
+ * the line length usually fits into the first chunk. */
+struct ast_arena *
+ast_arena_create(size_t size_hint)
+{
+    return arena_create_sized(4 * size_hint + ARENA_MIN_SIZE);
+}
+
+/* Allocate size bytes, suitably aligned for any type */
+void *
+ast_arena_alloc(struct ast_arena *arena, size_t size)
+{
+    size = (size + ARENA_ALIGN - 1) & ~(ARENA_ALIGN - 1);
+    if (size > arena->limit - arena->next) {
+        size_t chunk_size = size > arena->chunk_size ? size : arena->chunk_size;
+        struct ast_arena_chunk *chunk = malloc(sizeof *chunk + chunk_size);
+        if (chunk == NULL) {
+            fprintf(stderr, "out of memory parsing command line\n");
+            abort();
+        }
+        chunk->next = arena->chunks;
+        arena->chunks = chunk;
+        arena->next = (char *) chunk->data;
+        arena->limit = arena->next + chunk_size;
+        arena->chunk_size = 2 * chunk_size;
+    }
+
+    void *p = arena->next;
+    arena->next += size;
+    return p;
+}
+
+/* Copy the first len bytes of s into a NUL-terminated string */
+char *
+ast_arena_strndup(struct ast_arena *arena, const char *s, size_t len)
+{
+    char *copy = ast_arena_alloc(arena, len + 1);
+    memcpy(copy, s, len);
+    copy[len] = '\0';
+    return copy;
+}
+
+/* Take a reference */
+void
+ast_arena_retain(struct ast_arena *arena)
+{
+    arena->refcount++;
+}
+
+/* Drop a reference, freeing the arena with the last one */
+void
+ast_arena_release(struct ast_arena *arena)
+{
+    if (--arena->refcount > 0)
+        return;
+
+    for (struct ast_arena_chunk *chunk = arena->chunks; chunk != NULL; ) {
+        struct ast_arena_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+    if (arena->parent != NULL)
+        ast_arena_release(arena->parent);
+    free(arena);
+}
+
+/* Create new command structure.  argv must live in the same arena. */
 struct ast_command * 
-ast_command_create(char ** argv, bool dup_stderr_to_stdout)
+ast_command_create(struct ast_arena *arena, char ** argv, 
+                   bool dup_stderr_to_stdout)
 {
-    struct ast_command *cmd = malloc(sizeof *cmd);
+    struct ast_command *cmd = ast_arena_alloc(arena, sizeof *cmd);
 
     cmd->argv = argv;
+    cmd->glob_words = NULL;
     cmd->dup_stderr_to_stdout = dup_stderr_to_stdout;
     return cmd;
 }
 
 /* Create a new pipeline */
-struct ast_pipeline * ast_pipeline_create(char *iored_input, 
+struct ast_pipeline * ast_pipeline_create(struct ast_arena *arena,
+                                          char *iored_input, 
                                           char *iored_output, 
                                           bool append_to_output)
 {
-    struct ast_pipeline *pipe = malloc(sizeof *pipe);
+    struct ast_pipeline *pipe = ast_arena_alloc(arena, sizeof *pipe);
 
     list_init(&pipe->commands);
     pipe->iored_output = iored_output;
     pipe->iored_input = iored_input;
     pipe->append_to_output = append_to_output;
     pipe->bg_job = false;
+    pipe->arena = arena;
     return pipe;
 }
 
@@ -48,11 +159,12 @@ ast_pipeline_add_command(struct ast_pipeline *pipe, struct ast_command *cmd)
 
 /* Create an empty command line */
 struct ast_command_line *
-ast_command_line_create_empty(void)
+ast_command_line_create_empty(struct ast_arena *arena)
 {
-    struct ast_command_line *cmdline = malloc(sizeof *cmdline);
+    struct ast_command_line *cmdline = ast_arena_alloc(arena, sizeof *cmdline);
 
     list_init(&cmdline->pipes);
+    cmdline->arena = arena;
     return cmdline;
 }
 
@@ -60,7 +172,7 @@ ast_command_line_create_empty(void)
 struct ast_command_line *
 ast_command_line_create(struct ast_pipeline *pipe)
 {
-    struct ast_command_line *cmdline = ast_command_line_create_empty();
+    struct ast_command_line *cmdline = ast_command_line_create_empty(pipe->arena);
 
     list_push_back(&cmdline->pipes, &pipe->elem);
     return cmdline;
@@ -128,42 +240,77 @@ ast_command_line_print(struct ast_command_line *cmdline)
     printf("==========================================\n");
 }
 
-/* Deallocation functions. */
-void 
-ast_command_line_free(struct ast_command_line *cmdline)
+/* Copy the nodes of cmdline into a new command line.  The words are
+ * shared with cmdline, whose arena stays alive as long as the copy's. */
+struct ast_command_line *
+ast_command_line_clone(struct ast_command_line *cmdline)
 {
-    for (struct list_elem * e = list_begin(&cmdline->pipes); e != list_end(&cmdline->pipes); ) {
-        struct ast_pipeline *pipe = list_entry(e, struct ast_pipeline, elem);
-        e = list_remove(e);
-        ast_pipeline_free(pipe);
+    /* Size the first chunk so that the whole copy fits in one malloc */
+    size_t size = ARENA_ALIGN + sizeof(struct ast_command_line);
+    for (struct list_elem *p = list_begin(&cmdline->pipes);
+         p != list_end(&cmdline->pipes); p = list_next(p)) {
+        struct ast_pipeline *pipe = list_entry(p, struct ast_pipeline, elem);
+        size += ARENA_ALIGN + sizeof(struct ast_pipeline);
+        for (struct list_elem *c = list_begin(&pipe->commands);
+             c != list_end(&pipe->commands); c = list_next(c)) {
+            struct ast_command *cmd = list_entry(c, struct ast_command, elem);
+            size_t argc = 0;
+            while (cmd->argv[argc] != NULL)
+                argc++;
+            size += 2 * ARENA_ALIGN + sizeof(struct ast_command)
+                  + (argc + 1) * sizeof(char *);
+        }
     }
-    free(cmdline);
-}
 
-void 
-ast_pipeline_free(struct ast_pipeline *pipe)
-{
-    for (struct list_elem * e = list_begin(&pipe->commands); e != list_end(&pipe->commands); ) {
-        struct ast_command *cmd = list_entry(e, struct ast_command, elem);
-        e = list_remove(e);
-        ast_command_free(cmd);
+    struct ast_arena *arena = arena_create_sized(size);
+    if (arena == NULL)
+        return NULL;
+    arena->parent = cmdline->arena;
+    ast_arena_retain(cmdline->arena);
+
+    struct ast_command_line *copy = ast_command_line_create_empty(arena);
+    for (struct list_elem *p = list_begin(&cmdline->pipes);
+         p != list_end(&cmdline->pipes); p = list_next(p)) {
+        struct ast_pipeline *pipe = list_entry(p, struct ast_pipeline, elem);
+        struct ast_pipeline *pipecopy = ast_pipeline_create(arena,
+            pipe->iored_input, pipe->iored_output, pipe->append_to_output);
+        pipecopy->bg_job = pipe->bg_job;
+
+        for (struct list_elem *c = list_begin(&pipe->commands);
+             c != list_end(&pipe->commands); c = list_next(c)) {
+            struct ast_command *cmd = list_entry(c, struct ast_command, elem);
+            size_t argc = 0;
+            while (cmd->argv[argc] != NULL)
+                argc++;
+            char **argv = ast_arena_alloc(arena, (argc + 1) * sizeof *argv);
+            memcpy(argv, cmd->argv, (argc + 1) * sizeof *argv);
+            struct ast_command *cmdcopy = ast_command_create(arena, argv,
+                                                cmd->dup_stderr_to_stdout);
+            cmdcopy->glob_words = cmd->glob_words;
+            ast_pipeline_add_command(pipecopy, cmdcopy);
+        }
+        list_push_back(&copy->pipes, &pipecopy->elem);
     }
-    if (pipe->iored_input)
-        free(pipe->iored_input);
+    return copy;
+}
 
-    if (pipe->iored_output)
-        free(pipe->iored_output);
+/* Keep pipe alive after its command line has been freed */
+void
+ast_pipeline_retain(struct ast_pipeline *pipe)
+{
+    ast_arena_retain(pipe->arena);
+}
 
-    free(pipe);
+/* Deallocation functions.  Nodes are never freed individually; the whole
+ * arena goes away once the last reference to it is dropped. */
+void 
+ast_command_line_free(struct ast_command_line *cmdline)
+{
+    ast_arena_release(cmdline->arena);
 }
 
 void 
-ast_command_free(struct ast_command * cmd)
+ast_pipeline_free(struct ast_pipeline *pipe)
 {
-    char ** p = cmd->argv;
-    while (*p) {
-        free(*p++);
-    }
-    free(cmd->argv);
-    free(cmd);
+    ast_arena_release(pipe->arena);
 }
@@ -8,9 +8,30 @@ struct ast_command;
 struct ast_pipeline;
 struct ast_command_line;
 
+/* All nodes and words of a command line are allocated from one arena,
+ * which is freed in one go once the command line and every pipeline 
+ * retained from it have been freed.  Arenas are reference counted;
+ * creating one returns it with a count of 1.
+ */
+struct ast_arena;
+
+/* Create an arena, sized for a command line of about size_hint bytes */
+struct ast_arena * ast_arena_create(size_t size_hint);
+
+/* Allocate size bytes, suitably aligned for any type */
+void * ast_arena_alloc(struct ast_arena *arena, size_t size);
+
+/* Copy the first len bytes of s into a NUL-terminated string */
+char * ast_arena_strndup(struct ast_arena *arena, const char *s, size_t len);
+
+/* Take and drop a reference.  Dropping the last one frees the arena. */
+void ast_arena_retain(struct ast_arena *arena);
+void ast_arena_release(struct ast_arena *arena);
+
 /* A command line may contain multiple pipelines. */
 struct ast_command_line {
     struct list/* <ast_pipeline> */ pipes;        /* List of pipelines */
+    struct ast_arena *arena; /* Holds this command line and everything in it */
 };
 
 /* A pipeline is a list of one or more commands. 
@@ -25,38 +46,53 @@ struct ast_pipeline {
     bool append_to_output;   /* True if user typed >> to append */
     bool bg_job;             /* True if user entered & */
     struct list_elem elem;   /* Link element. */
+    struct ast_arena *arena; /* The arena of the command line it came from */
 };
 
 /* A command is part of a pipeline. */
 struct ast_command {
     char **argv;             /* NULL terminated array of pointers to words
                                 making up this command. */
+    bool *glob_words;        /* If non-NULL, glob_words[i] is true if 
+                                argv[i] is a pattern to be expanded. */
     bool dup_stderr_to_stdout; /* True if stderr should be redirected as well */
     struct list_elem elem;   /* Link element to link commands in pipeline. */
 };
 
 /* Create new command structure and initialize it */
-struct ast_command * ast_command_create(char ** argv,
+struct ast_command * ast_command_create(struct ast_arena *arena,
+                                        char ** argv,
                                         bool dup_stderr_to_stdout);
 
 /* Create a new pipeline containing only one command */
-struct ast_pipeline * ast_pipeline_create(char *iored_input, 
+struct ast_pipeline * ast_pipeline_create(struct ast_arena *arena,
+                                          char *iored_input, 
                                           char *iored_output, 
                                           bool append_to_output);
 
 /* Add a new command to this pipeline */
 void ast_pipeline_add_command(struct ast_pipeline *pipe, struct ast_command *cmd);
 
-/* Create an empty command line */
-struct ast_command_line * ast_command_line_create_empty(void);
+/* Create an empty command line.  Takes over the caller's arena reference */
+struct ast_command_line * ast_command_line_create_empty(struct ast_arena *arena);
 
-/* Create a command line with a single pipeline */
+/* Create a command line with a single pipeline.  Takes over the caller's 
+ * reference to the pipeline's arena */
 struct ast_command_line * ast_command_line_create(struct ast_pipeline *pipe);
 
-/* Deallocation functions */
+/* Copy the nodes of cmdline into a new command line that can be freed
+ * independently of it.  The words are shared, not copied, and must 
+ * therefore not be modified in either command line. */
+struct ast_command_line * ast_command_line_clone(
+                                    struct ast_command_line *cmdline);
+
+/* Keep pipe alive after its command line has been freed, until it is
+ * freed with ast_pipeline_free itself */
+void ast_pipeline_retain(struct ast_pipeline *pipe);
+
+/* Deallocation functions.  These drop a reference to the arena. */
 void ast_command_line_free(struct ast_command_line *);
 void ast_pipeline_free(struct ast_pipeline *);
-void ast_command_free(struct ast_command *);
 
 /* Print functions */
 void ast_command_print(struct ast_command *cmd);
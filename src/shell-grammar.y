@@ -9,15 +9,15 @@
  * This is based on an assignment as an undergraduate in 1993 
  * as an undergraduate student at Technische Universitaet Berlin.
  *
- * Known bugs: leaks memory when parse errors occur.
+ * The parser is reentrant: all of its state lives in a struct parse_state
+ * and a flex scanner created per command line, and everything it
+ * allocates comes from the command line's arena.
  */
 %{
 #include <stdio.h>
 #include <stdlib.h>
 #define YYDEBUG	1
 int yydebug;
-void yyerror(const char *msg);
-int yylex(void);
 
 /*
  * Error messages, csh-style
@@ -28,14 +28,26 @@ int yylex(void);
 #define AMBOUT  "Ambiguous output redirect."
 
 #include "shell-ast.h"
-#include <obstack.h>
 #include <assert.h>
 
-#define obstack_chunk_alloc malloc
-#define obstack_chunk_free free
+/* Everything one invocation of the parser needs; the scanner reaches it 
+ * through yyextra. */
+struct parse_state {
+    struct ast_arena *arena;                /* holds all tokens and nodes */
+    struct ast_command_line *commandline;   /* result of a successful parse */
+};
+
+struct word_list {
+    char *word;
+    bool glob;                  /* word is a pattern to be expanded */
+    struct word_list *next;
+};
 
 struct cmd_helper {
-    struct obstack words;   /* an obstack of char * to collect argv */
+    struct word_list *words;    /* words collected for argv, in order */
+    struct word_list **tail;
+    int nwords;
+    bool has_glob;              /* some word is a pattern */
     char *iored_input;
     char *iored_output;
     bool append_to_output;
@@ -48,23 +60,41 @@ struct pipe_helper {
 };
 
 static struct pipe_helper *
-init_pipe()
+init_pipe(struct ast_arena *arena)
 {
-    struct pipe_helper * pipe = calloc(1, sizeof *pipe);
+    struct pipe_helper * pipe = ast_arena_alloc(arena, sizeof *pipe);
     list_init(&pipe->commands);
     return pipe;
 }
 
+/* Append word to cmd's argv */
+static void
+add_word(struct ast_arena *arena, struct cmd_helper *cmd, char *word, 
+         bool glob)
+{
+    struct word_list *w = ast_arena_alloc(arena, sizeof *w);
+    w->word = word;
+    w->glob = glob;
+    cmd->has_glob |= glob;
+    w->next = NULL;
+    *cmd->tail = w;
+    cmd->tail = &w->next;
+    cmd->nwords++;
+}
+
 /* Initialize cmd_helper and, optionally, set first argv */
 static struct cmd_helper *
-init_cmd(char *firstcmd, 
+init_cmd(struct ast_arena *arena, char *firstcmd, 
          char *iored_input, char *iored_output, 
          bool append_to_output, bool include_stderr)
 {
-    struct cmd_helper * cmd = malloc(sizeof *cmd);
-    obstack_init(&cmd->words);
+    struct cmd_helper * cmd = ast_arena_alloc(arena, sizeof *cmd);
+    cmd->words = NULL;
+    cmd->tail = &cmd->words;
+    cmd->nwords = 0;
+    cmd->has_glob = false;
     if (firstcmd)
-        obstack_ptr_grow(&cmd->words, firstcmd);
+        add_word(arena, cmd, firstcmd, false);
 
     cmd->iored_output = iored_output;
     cmd->iored_input = iored_input;
@@ -80,21 +110,26 @@ static void p_error(char *msg);
  * Ensures NULL-terminated argv[] array
  */
 static struct ast_command * 
-make_ast_command(struct cmd_helper *cmd)
+make_ast_command(struct ast_arena *arena, struct cmd_helper *cmd)
 {
-    obstack_ptr_grow(&cmd->words, NULL);
-
-    int sz = obstack_object_size(&cmd->words);
-    char **argv = malloc(sz);
-    memcpy(argv, obstack_finish(&cmd->words), sz);
-    obstack_free(&cmd->words, NULL);
-
-    if (*argv == NULL) {
-        free(argv);
+    if (cmd->nwords == 0)
         return NULL; 
-    }
 
-    return ast_command_create(argv, cmd->redirect_stderr);
+    char **argv = ast_arena_alloc(arena, (cmd->nwords + 1) * sizeof *argv);
+    char **arg = argv;
+    for (struct word_list *w = cmd->words; w != NULL; w = w->next)
+        *arg++ = w->word;
+    *arg = NULL;
+
+    struct ast_command *command = ast_command_create(arena, argv, 
+                                                     cmd->redirect_stderr);
+    if (cmd->has_glob) {
+        bool *glob = ast_arena_alloc(arena, cmd->nwords * sizeof *glob);
+        command->glob_words = glob;
+        for (struct word_list *w = cmd->words; w != NULL; w = w->next)
+            *glob++ = w->glob;
+    }
+    return command;
 }
 
 static bool
@@ -114,21 +149,18 @@ add_to_pipeline(struct pipe_helper *pipe,
         if (cmd->iored_input) { p_error(AMBINP); return false; }
     }
 
-    int sz = obstack_object_size(&cmd->words);
-    if (sz == 0) { p_error(INVNUL); return false; }
+    if (cmd->nwords == 0) { p_error(INVNUL); return false; }
 
     list_push_back(&pipe->commands, &cmd->elem);
     return true;
 }
 
-/* Called by parser when command line is complete */
-static void cmdline_complete(struct ast_command_line *);
-
-/* work-around for bug in flex 2.31 and later */
-static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
-
 %}
 
+%define api.pure full
+%lex-param   {void *scanner}
+%parse-param {void *scanner} {struct parse_state *state}
+
 /* LALR stack types */
 %union {
   struct cmd_helper *command;
@@ -138,21 +170,27 @@ static void yyunput (int c,char *buf_ptr  ) __attribute__((unused));
   char *word;
 }
 
+%code {
+int yylex(YYSTYPE *lvalp, void *scanner);
+void yyerror(void *scanner, struct parse_state *state, const char *msg);
+}
+
 /* Nonterminals */
 %type <command> input output
 %type <command> command
 %type <pipe> pipeline
 %type <ast_pipe> ast_pipeline
 %type <cmdline> cmd_list
+%type <word> word
 
 /* Terminals */
-%token <word> WORD
+%token <word> WORD GLOB_WORD
 %token GREATER_GREATER GREATER_AMPERSAND PIPE_AMPERSAND
 
 %%
-cmd_line: cmd_list { cmdline_complete($1); }
+cmd_line: cmd_list { state->commandline = $1; }
 
-cmd_list:	/* Null Command */ { $$ = ast_command_line_create_empty(); }
+cmd_list:	/* Null Command */ { $$ = ast_command_line_create_empty(state->arena); }
 |		ast_pipeline { 
             $$ = ast_command_line_create($1);
         } 
@@ -191,6 +229,7 @@ ast_pipeline: pipeline {
             last = list_entry(list_back(&pipe->commands), struct cmd_helper, elem);
 
             $$ = ast_pipeline_create(
+                state->arena,
                 first->iored_input,
                 last->iored_output,
                 last->append_to_output
@@ -198,15 +237,13 @@ ast_pipeline: pipeline {
             for (struct list_elem * e = list_begin(&pipe->commands);
                                     e != list_end(&pipe->commands);) {
                 struct cmd_helper * cmd = list_entry(e, struct cmd_helper, elem);
-                ast_pipeline_add_command($$, make_ast_command(cmd));
+                ast_pipeline_add_command($$, make_ast_command(state->arena, cmd));
                 e = list_remove(e);
-                free(cmd);
             }
-            free(pipe);
         }
 
 pipeline: command {
-            $$ = init_pipe();
+            $$ = init_pipe(state->arena);
             if (!add_to_pipeline($$, $1, false))
                 YYABORT;
 		}
@@ -224,58 +261,62 @@ pipeline: command {
 |		pipeline '|' error { p_error(INVNUL); YYABORT; }
 
 command:   WORD { 
-            $$ = init_cmd($1, NULL, NULL, false, false);
+            $$ = init_cmd(state->arena, $1, NULL, NULL, false, false);
+        }
+|		GLOB_WORD { 
+            $$ = init_cmd(state->arena, NULL, NULL, NULL, false, false);
+            add_word(state->arena, $$, $1, true);
         }
 |		input   
 |		output
 |		command WORD {
             $$ = $1;
-            obstack_ptr_grow(&$$->words, $2);
+            add_word(state->arena, $$, $2, false);
+		}
+|		command GLOB_WORD {
+            $$ = $1;
+            add_word(state->arena, $$, $2, true);
 		}
 |		command input {
-            obstack_free(&$2->words, NULL);
             /* Error: ambiguous redirect 'a <b <c' */
             if ($1->iored_input)   { p_error(AMBINP); YYABORT; }
             $$ = $1; 
             $$->iored_input = $2->iored_input;
-            free($2);
 		}
 |		command output {
-            obstack_free(&$2->words, NULL);
             /* Error: ambiguous redirect 'a >b >c' */
             if ($1->iored_output) { p_error(AMBOUT); YYABORT; }
             $$ = $1; 
             $$->iored_output = $2->iored_output;
             $$->append_to_output = $2->append_to_output;
             $$->redirect_stderr = $2->redirect_stderr;
-            free($2);
 		}
 
-input:	'<' WORD { 
-            $$ = init_cmd(NULL, $2, NULL, false, false);
+input:	'<' word { 
+            $$ = init_cmd(state->arena, NULL, $2, NULL, false, false);
         }
 |		'<' error	  { p_error(MISRED); YYABORT; }
 
-output:	'>' WORD { 
-            $$ = init_cmd(NULL, NULL, $2, false, false);
+output:	'>' word { 
+            $$ = init_cmd(state->arena, NULL, NULL, $2, false, false);
         }
-|		GREATER_AMPERSAND WORD { 
-            $$ = init_cmd(NULL, NULL, $2, false, true);
+|		GREATER_AMPERSAND word { 
+            $$ = init_cmd(state->arena, NULL, NULL, $2, false, true);
         }
-|		GREATER_GREATER WORD { 
-            $$ = init_cmd(NULL, NULL, $2, true, false);
+|		GREATER_GREATER word { 
+            $$ = init_cmd(state->arena, NULL, NULL, $2, true, false);
         }
 		/* Error: missing redirect */
 |		'>' error 	  { p_error(MISRED); YYABORT; }
 |		GREATER_GREATER error { p_error(MISRED); YYABORT; }
 
-%%
-static char * inputline;    /* currently processed input line */
-#define YY_INPUT(buf,result,max_size) \
-    { \
-        result = *inputline ? (buf[0] = *inputline++, 1) : YY_NULL; \
-    }
+/* Redirections are not expanded, a pattern names a file literally */
+word:	WORD
+|		GLOB_WORD
 
+%%
+/* The scanner works on an in-memory copy of the command line set up by 
+ * ast_parse_command_line, so there is no need for YY_INPUT. */
 #define YY_NO_INPUT
 #include "lex.yy.c"
 
@@ -286,17 +327,9 @@ p_error(char *msg)
     fprintf(stderr, "%s\n", msg); 
 }
 
-extern int yyparse (void);
-
 /* do not use default error handling since errors are handled above. */
 void 
-yyerror(const char *msg) { }
-
-static struct ast_command_line * commandline;
-static void cmdline_complete(struct ast_command_line *cline)
-{
-    commandline = cline;
-}
+yyerror(void *scanner, struct parse_state *state, const char *msg) { }
 
 /* 
  * parse a commandline.
@@ -304,10 +337,28 @@ static void cmdline_complete(struct ast_command_line *cline)
 struct ast_command_line *
 ast_parse_command_line(char * line)
 {
-    inputline = line;
-    commandline = NULL;
-
-    int error = yyparse();
+    struct parse_state state = { .arena = ast_arena_create(strlen(line)) };
+    if (state.arena == NULL)
+        return NULL;
+
+    yyscan_t scanner;
+    if (yylex_init_extra(&state, &scanner)) {
+        ast_arena_release(state.arena);
+        return NULL;
+    }
 
-    return error ? NULL : commandline;
+    /* Scan the whole line in one buffer rather than one character per
+     * YY_INPUT call. */
+    YY_BUFFER_STATE buffer = yy_scan_string(line, scanner);
+    int error = yyparse(scanner, &state);
+    yy_delete_buffer(buffer, scanner);
+    yylex_destroy(scanner);
+
+    /* A failed parse may have left nodes and words anywhere in the 
+     * arena; they all go away together. */
+    if (error || state.commandline == NULL) {
+        ast_arena_release(state.arena);
+        return NULL;
+    }
+    return state.commandline;
 }
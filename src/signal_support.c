@@ -5,7 +5,11 @@
  * Virginia Tech.
  */
 
+#define _GNU_SOURCE    1
 #include <signal.h>
+#include <sys/signalfd.h>
+#include <unistd.h>
+#include <errno.h>
 #include <assert.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -14,6 +18,22 @@
 
 #include "signal_support.h"
 #include "utils.h"
+#include "../posix_spawn/spawn.h"
+
+/* Signals signal_set_handler has installed a handler for */
+static sigset_t handled_signals;
+static bool handlers_tracked;
+
+/* Tell libspawn that all handlers are installed through
+ * signal_set_handler, so children only reset those before exec'ing.
+ * readline's own handlers are only installed while a line is being read
+ * and are gone by the time the shell spawns anything. */
+void
+signal_track_handlers(void)
+{
+    handlers_tracked = true;
+    posix_spawn_sethandlers_np(&handled_signals);
+}
 
 /* Return true if this signal is blocked */
 bool 
@@ -82,4 +102,39 @@ signal_set_handler(int sig, sa_sigaction_t handler)
 
     if (sigaction(sig, &sa, NULL) != 0)
         utils_fatal_error("sigaction failed for signal %d", sig);
+
+    sigaddset(&handled_signals, sig);
+    if (handlers_tracked)
+        posix_spawn_sethandlers_np(&handled_signals);
+}
+
+/* Block signal 'sig' for good and return a signalfd through which its
+ * deliveries can be read synchronously.  The fd is non-blocking and
+ * close-on-exec. */
+int
+signal_create_fd(int sig)
+{
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, sig);
+    if (sigprocmask(SIG_BLOCK, &mask, NULL) != 0)
+        utils_fatal_error("sigprocmask failed for %d", sig);
+
+    int fd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if (fd == -1)
+        utils_fatal_error("signalfd failed for signal %d: ", sig);
+    return fd;
+}
+
+/* Consume all pending signals from a signalfd created by signal_create_fd */
+void
+signal_drain_fd(int fd)
+{
+    struct signalfd_siginfo info[8];
+    ssize_t n;
+    while ((n = read(fd, info, sizeof info)) == sizeof info)
+        continue;
+
+    if (n == -1 && errno != EAGAIN && errno != EINTR)
+        utils_error("reading signalfd failed: ");
 }
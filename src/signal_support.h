@@ -19,4 +19,15 @@ bool signal_unblock(int sig);
 /* Install signal handler for signal 'sig' */
 void signal_set_handler(int sig, sa_sigaction_t handler);
 
+/* Let spawned children reset only the signals that have handlers
+ * installed through signal_set_handler */
+void signal_track_handlers(void);
+
+/* Block signal 'sig' for good and return a signalfd through which
+ * its deliveries can be read synchronously */
+int signal_create_fd(int sig);
+
+/* Consume all pending signals from a signalfd created by signal_create_fd */
+void signal_drain_fd(int fd);
+
 #endif /* __SIGNAL_SUPPORT_H */
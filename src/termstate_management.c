@@ -29,13 +29,10 @@ termstate_init(void)
     char *tty;
     assert(terminal_fd == -1 || !!!"termstate_init already called");
 
-    terminal_fd = open(tty = ctermid(NULL), O_RDWR);
+    terminal_fd = open(tty = ctermid(NULL), O_RDWR | O_CLOEXEC);
     if (terminal_fd == -1)
         utils_fatal_error("opening controlling terminal %s failed: ", tty);
 
-    if (utils_set_cloexec(terminal_fd))
-        utils_fatal_error("cannot mark terminal fd FD_CLOEXEC");
-
     shell_pgrp = getpgrp();
     termstate_sample();
 }
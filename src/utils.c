@@ -10,6 +10,7 @@
 #include <stdarg.h>
 #include <fcntl.h>
 #include <assert.h>
+#include <limits.h>
 
 #include "utils.h"
 
@@ -57,3 +58,27 @@ utils_set_cloexec(int fd)
     return fcntl(fd, F_SETFD, oldflags | FD_CLOEXEC);
 }
 
+
+/* Parse a size such as "65536", "256K" or "1M" (binary units) into *size,
+ * return error indicator */
+int
+utils_parse_size(const char *s, long *size)
+{
+    char *end;
+    errno = 0;
+    long value = strtol(s, &end, 10);
+    if (end == s || errno != 0 || value < 0)
+        return -1;
+
+    int shift = 0;
+    switch (*end) {
+    case 'k': case 'K': shift = 10; end++; break;
+    case 'm': case 'M': shift = 20; end++; break;
+    case 'g': case 'G': shift = 30; end++; break;
+    }
+    if (*end != '\0' || value > (LONG_MAX >> shift))
+        return -1;
+
+    *size = value << shift;
+    return 0;
+}
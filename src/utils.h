@@ -6,3 +6,6 @@ void utils_error(char *fmt, ...);
 
 /* Print information about the last syscall error and then exit */
 void utils_fatal_error(char *fmt, ...);
+
+/* Parse a size with an optional K, M or G suffix, return error indicator */
+int utils_parse_size(const char *s, long *size);